@@ -0,0 +1,236 @@
+/* 
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "mock_usbh.h"
+#include "host/usbh_pvt.h"
+#include "class/audio/audio.h"
+#include "class/midi/midi.h"
+#include "usb_midi_host.h"
+
+//--------------------------------------------------------------------+
+// MACRO CONSTANT TYPEDEF
+//--------------------------------------------------------------------+
+#define MOCK_EP_IN_ADDR  0x81
+#define MOCK_EP_OUT_ADDR 0x01
+
+typedef struct
+{
+  uint8_t ep_addr;
+  bool opened;
+  bool claimed;
+  bool busy;
+  uint8_t* buffer;      // the driver's transfer buffer
+  uint16_t total_bytes; // the driver's requested transfer length
+} mock_edpt_t;
+
+typedef struct
+{
+  mock_edpt_t ep_in;
+  mock_edpt_t ep_out;
+} mock_device_t;
+
+static mock_device_t _mock_dev[CFG_TUH_DEVICE_MAX];
+static uint32_t _mock_time_us;
+
+static mock_device_t* get_mock_device(uint8_t dev_addr)
+{
+  TU_VERIFY(dev_addr > 0 && dev_addr <= CFG_TUH_DEVICE_MAX, NULL);
+  return _mock_dev + dev_addr - 1;
+}
+
+static mock_edpt_t* get_mock_edpt(uint8_t dev_addr, uint8_t ep_addr)
+{
+  mock_device_t* dev = get_mock_device(dev_addr);
+  TU_VERIFY(dev != NULL, NULL);
+  if (dev->ep_in.opened && dev->ep_in.ep_addr == ep_addr)
+    return &dev->ep_in;
+  if (dev->ep_out.opened && dev->ep_out.ep_addr == ep_addr)
+    return &dev->ep_out;
+  return NULL;
+}
+
+//--------------------------------------------------------------------+
+// usbh stand-ins called by the driver
+//--------------------------------------------------------------------+
+bool tuh_edpt_open(uint8_t dev_addr, tusb_desc_endpoint_t const * desc_ep)
+{
+  mock_device_t* dev = get_mock_device(dev_addr);
+  TU_VERIFY(dev != NULL);
+  mock_edpt_t* ep = (tu_edpt_dir(desc_ep->bEndpointAddress) == TUSB_DIR_IN) ? &dev->ep_in : &dev->ep_out;
+  tu_memclr(ep, sizeof(*ep));
+  ep->ep_addr = desc_ep->bEndpointAddress;
+  ep->opened = true;
+  return true;
+}
+
+// usbh_edpt_xfer() is an inline wrapper around this function in usbh_pvt.h
+bool usbh_edpt_xfer_with_callback(uint8_t dev_addr, uint8_t ep_addr, uint8_t * buffer, uint16_t total_bytes, tuh_xfer_cb_t complete_cb, uintptr_t user_data)
+{
+  (void) complete_cb;
+  (void) user_data;
+  mock_edpt_t* ep = get_mock_edpt(dev_addr, ep_addr);
+  TU_VERIFY(ep != NULL && !ep->busy);
+  ep->busy = true;
+  ep->buffer = buffer;
+  ep->total_bytes = total_bytes;
+  return true;
+}
+
+bool usbh_edpt_claim(uint8_t dev_addr, uint8_t ep_addr)
+{
+  mock_edpt_t* ep = get_mock_edpt(dev_addr, ep_addr);
+  TU_VERIFY(ep != NULL && !ep->busy && !ep->claimed);
+  ep->claimed = true;
+  return true;
+}
+
+bool usbh_edpt_release(uint8_t dev_addr, uint8_t ep_addr)
+{
+  mock_edpt_t* ep = get_mock_edpt(dev_addr, ep_addr);
+  TU_VERIFY(ep != NULL && ep->claimed);
+  ep->claimed = false;
+  return true;
+}
+
+bool usbh_edpt_busy(uint8_t dev_addr, uint8_t ep_addr)
+{
+  mock_edpt_t* ep = get_mock_edpt(dev_addr, ep_addr);
+  TU_VERIFY(ep != NULL);
+  return ep->busy;
+}
+
+void usbh_driver_set_config_complete(uint8_t dev_addr, uint8_t itf_num)
+{
+  (void) dev_addr;
+  (void) itf_num;
+}
+
+//--------------------------------------------------------------------+
+// Bench API
+//--------------------------------------------------------------------+
+bool mock_usbh_mount(uint8_t dev_addr, uint8_t num_cables, uint16_t ep_size)
+{
+  mock_device_t* dev = get_mock_device(dev_addr);
+  TU_VERIFY(dev != NULL && num_cables > 0 && num_cables <= 16);
+  tu_memclr(dev, sizeof(*dev));
+
+  // interface + CS interface header + 2 x (endpoint + CS endpoint)
+  uint8_t desc[9 + 7 + 2*(9 + 4 + 16)];
+  uint16_t len = 0;
+
+  uint8_t const itf[] = {9, TUSB_DESC_INTERFACE, 0, 0, 2, TUSB_CLASS_AUDIO, AUDIO_SUBCLASS_MIDI_STREAMING, 0, 0};
+  memcpy(desc + len, itf, sizeof(itf));
+  len += sizeof(itf);
+
+  uint8_t const header[] = {7, TUSB_DESC_CS_INTERFACE, MIDI_CS_INTERFACE_HEADER, 0x00, 0x01, 0, 0};
+  memcpy(desc + len, header, sizeof(header));
+  len += sizeof(header);
+
+  uint8_t const ep_addrs[] = {MOCK_EP_OUT_ADDR, MOCK_EP_IN_ADDR};
+  for (size_t idx = 0; idx < sizeof(ep_addrs); idx++)
+  {
+    uint8_t const ep[] = {9, TUSB_DESC_ENDPOINT, ep_addrs[idx], TUSB_XFER_BULK,
+                          (uint8_t)(ep_size & 0xff), (uint8_t)(ep_size >> 8), 0, 0, 0};
+    memcpy(desc + len, ep, sizeof(ep));
+    len += sizeof(ep);
+    desc[len++] = (uint8_t)(4 + num_cables);
+    desc[len++] = TUSB_DESC_CS_ENDPOINT;
+    desc[len++] = MIDI_CS_ENDPOINT_GENERAL;
+    desc[len++] = num_cables;
+    for (uint8_t jack = 0; jack < num_cables; jack++)
+    {
+      desc[len++] = (uint8_t)(jack + 1);
+    }
+  }
+
+  TU_VERIFY(midih_open(0, dev_addr, (tusb_desc_interface_t const *)desc, len));
+  return midih_set_config(dev_addr, 0);
+}
+
+void mock_usbh_unmount(uint8_t dev_addr)
+{
+  midih_close(dev_addr);
+  mock_device_t* dev = get_mock_device(dev_addr);
+  if (dev != NULL)
+  {
+    tu_memclr(dev, sizeof(*dev));
+  }
+}
+
+bool mock_usbh_in_xfer(uint8_t dev_addr, uint8_t const* data, uint16_t len)
+{
+  mock_device_t* dev = get_mock_device(dev_addr);
+  TU_VERIFY(dev != NULL && dev->ep_in.busy && len <= dev->ep_in.total_bytes);
+  memcpy(dev->ep_in.buffer, data, len);
+  // usbh.c marks the endpoint free before calling the class driver
+  dev->ep_in.busy = false;
+  dev->ep_in.claimed = false;
+  return midih_xfer_cb(dev_addr, dev->ep_in.ep_addr, XFER_RESULT_SUCCESS, len);
+}
+
+bool mock_usbh_in_fill(uint8_t dev_addr, uint8_t const* data, uint16_t len)
+{
+  mock_device_t* dev = get_mock_device(dev_addr);
+  TU_VERIFY(dev != NULL && dev->ep_in.busy && len <= dev->ep_in.total_bytes);
+  memcpy(dev->ep_in.buffer, data, len);
+  return true;
+}
+
+uint16_t mock_usbh_out_xfer(uint8_t dev_addr, uint8_t* data, uint16_t maxlen)
+{
+  mock_device_t* dev = get_mock_device(dev_addr);
+  TU_VERIFY(dev != NULL && dev->ep_out.busy, 0);
+  uint16_t const xferred = dev->ep_out.total_bytes;
+  if (data != NULL)
+  {
+    memcpy(data, dev->ep_out.buffer, TU_MIN(xferred, maxlen));
+  }
+  dev->ep_out.busy = false;
+  dev->ep_out.claimed = false;
+  midih_xfer_cb(dev_addr, dev->ep_out.ep_addr, XFER_RESULT_SUCCESS, xferred);
+  return xferred;
+}
+
+bool mock_usbh_in_pending(uint8_t dev_addr)
+{
+  mock_device_t* dev = get_mock_device(dev_addr);
+  return dev != NULL && dev->ep_in.busy;
+}
+
+bool mock_usbh_out_pending(uint8_t dev_addr)
+{
+  mock_device_t* dev = get_mock_device(dev_addr);
+  return dev != NULL && dev->ep_out.busy;
+}
+
+uint32_t mock_usbh_time_us(void)
+{
+  return _mock_time_us;
+}
+
+void mock_usbh_advance_us(uint32_t us)
+{
+  _mock_time_us += us;
+}
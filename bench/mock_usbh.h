@@ -0,0 +1,80 @@
+/* 
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * A stand-in for the parts of the TinyUSB host stack that usb_midi_host.c
+ * calls. Instead of talking to a host controller, transfers queued by the
+ * driver stay pending until the bench program completes them with scripted
+ * data. This lets the driver run natively on a workstation.
+ */
+#ifndef _MOCK_USBH_H_
+#define _MOCK_USBH_H_
+
+#include "tusb_option.h"
+#include "host/usbh.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// Build a MIDI streaming interface descriptor with one bulk IN and one bulk
+// OUT endpoint of ep_size bytes each and num_cables embedded jacks on each
+// endpoint. Then open and configure the driver for dev_addr the way usbh.c
+// would during enumeration. Returns true if the driver accepted the interface.
+bool mock_usbh_mount(uint8_t dev_addr, uint8_t num_cables, uint16_t ep_size);
+
+// Close the driver for dev_addr as usbh.c would on device removal
+void mock_usbh_unmount(uint8_t dev_addr);
+
+// Complete the pending IN transfer for dev_addr with len bytes of data.
+// Returns false if the driver has not queued an IN transfer or if len is
+// larger than the requested transfer length.
+bool mock_usbh_in_xfer(uint8_t dev_addr, uint8_t const* data, uint16_t len);
+
+// Copy len bytes of data into the buffer of the pending IN transfer for
+// dev_addr without completing it, as the host controller would while the
+// driver is still busy with the previous transfer. Returns false if the
+// driver has not queued an IN transfer or if len is too large.
+bool mock_usbh_in_fill(uint8_t dev_addr, uint8_t const* data, uint16_t len);
+
+// Complete the pending OUT transfer for dev_addr. If data is not NULL, copy
+// up to maxlen bytes of what the driver sent to it. Returns the number of
+// bytes the driver sent, or 0 if there was no OUT transfer pending.
+uint16_t mock_usbh_out_xfer(uint8_t dev_addr, uint8_t* data, uint16_t maxlen);
+
+// Return true if the driver has a transfer queued on the IN endpoint
+bool mock_usbh_in_pending(uint8_t dev_addr);
+
+// Return true if the driver has a transfer queued on the OUT endpoint
+bool mock_usbh_out_pending(uint8_t dev_addr);
+
+// Move the driver's microsecond clock (CFG_TUH_MIDI_TIME_US) forward
+void mock_usbh_advance_us(uint32_t us);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _MOCK_USBH_H_ */
@@ -0,0 +1,152 @@
+/* 
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * This program turns a dump of the USB MIDI host driver's trace ring
+ * into a timeline. The dump is the tuh_midi_trace_record_t records that
+ * tuh_midi_trace_read() returned, written back to back in the target's
+ * little endian byte order. Each line shows the time of the event, the
+ * time since the previous event, the device address, the event and the
+ * event's argument.
+ *
+ * Usage: midih_trace_decode [dump file]
+ * Reads the dump from stdin if there is no file name.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "usb_midi_host_trace.h"
+
+static const char* event_names[TUH_MIDI_TRACE_NUM_EVENTS] = {
+  [TUH_MIDI_TRACE_LOST] = "LOST",
+  [TUH_MIDI_TRACE_MOUNT] = "MOUNT",
+  [TUH_MIDI_TRACE_UMOUNT] = "UMOUNT",
+  [TUH_MIDI_TRACE_IN_SUBMIT] = "IN_SUBMIT",
+  [TUH_MIDI_TRACE_IN_DONE] = "IN_DONE",
+  [TUH_MIDI_TRACE_OUT_SUBMIT] = "OUT_SUBMIT",
+  [TUH_MIDI_TRACE_OUT_DONE] = "OUT_DONE",
+  [TUH_MIDI_TRACE_XFER_FAILED] = "XFER_FAILED",
+  [TUH_MIDI_TRACE_RX_QUEUED] = "RX_QUEUED",
+  [TUH_MIDI_TRACE_RX_LEVEL] = "RX_LEVEL",
+  [TUH_MIDI_TRACE_RX_CB_ENTER] = "RX_CB_ENTER",
+  [TUH_MIDI_TRACE_RX_CB_EXIT] = "RX_CB_EXIT",
+  [TUH_MIDI_TRACE_RT_CB_ENTER] = "RT_CB_ENTER",
+  [TUH_MIDI_TRACE_RT_CB_EXIT] = "RT_CB_EXIT",
+  [TUH_MIDI_TRACE_TX_CB_ENTER] = "TX_CB_ENTER",
+  [TUH_MIDI_TRACE_TX_CB_EXIT] = "TX_CB_EXIT",
+  [TUH_MIDI_TRACE_FLUSH] = "FLUSH",
+  [TUH_MIDI_TRACE_TX_HELD] = "TX_HELD",
+  [TUH_MIDI_TRACE_RX_PAUSE] = "RX_PAUSE",
+  [TUH_MIDI_TRACE_RX_RESUME] = "RX_RESUME",
+};
+
+// Print the argument in the form that suits the event
+static void print_arg(uint8_t event, uint16_t arg)
+{
+  switch (event)
+  {
+    case TUH_MIDI_TRACE_LOST:
+      printf("%u records", arg);
+      break;
+    case TUH_MIDI_TRACE_MOUNT:
+      printf("%u tx cables, %u rx cables", arg >> 8, arg & 0xff);
+      break;
+    case TUH_MIDI_TRACE_XFER_FAILED:
+      printf("ep 0x%02x result %u", arg >> 8, arg & 0xff);
+      break;
+    case TUH_MIDI_TRACE_RT_CB_ENTER:
+      printf("status 0x%02x", arg);
+      break;
+    case TUH_MIDI_TRACE_RX_QUEUED:
+    case TUH_MIDI_TRACE_RX_CB_ENTER:
+      printf("%u packets", arg);
+      break;
+    case TUH_MIDI_TRACE_OUT_SUBMIT:
+      if (arg == 0)
+      {
+        printf("ZLP");
+        break;
+      }
+      // fall through
+    case TUH_MIDI_TRACE_IN_SUBMIT:
+    case TUH_MIDI_TRACE_IN_DONE:
+    case TUH_MIDI_TRACE_OUT_DONE:
+    case TUH_MIDI_TRACE_RX_LEVEL:
+    case TUH_MIDI_TRACE_FLUSH:
+    case TUH_MIDI_TRACE_TX_HELD:
+    case TUH_MIDI_TRACE_RX_RESUME:
+      printf("%u bytes", arg);
+      break;
+    default:
+      break;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  FILE* in = stdin;
+  if (argc > 1)
+  {
+    in = fopen(argv[1], "rb");
+    if (in == NULL)
+    {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+
+  uint8_t raw[sizeof(tuh_midi_trace_record_t)];
+  uint32_t first_us = 0;
+  uint32_t prev_us = 0;
+  unsigned long nrecords = 0;
+  while (fread(raw, sizeof(raw), 1, in) == 1)
+  {
+    // decode the bytes so the tool works on big endian hosts too
+    tuh_midi_trace_record_t rec;
+    rec.time_us = (uint32_t)raw[0] | ((uint32_t)raw[1] << 8) | ((uint32_t)raw[2] << 16) | ((uint32_t)raw[3] << 24);
+    rec.event = raw[4];
+    rec.dev_addr = raw[5];
+    rec.arg = (uint16_t)(raw[6] | (raw[7] << 8));
+    if (nrecords == 0)
+    {
+      first_us = rec.time_us;
+      prev_us = rec.time_us;
+    }
+    // unsigned differences keep the times right when the clock wraps
+    printf("%12lu us %+9ld us  dev %3u  ", (unsigned long)(uint32_t)(rec.time_us - first_us),
+      (long)(int32_t)(rec.time_us - prev_us), rec.dev_addr);
+    if (rec.event < TUH_MIDI_TRACE_NUM_EVENTS)
+      printf("%-12s ", event_names[rec.event]);
+    else
+      printf("EVENT_%-6u ", rec.event);
+    print_arg(rec.event, rec.arg);
+    printf("\n");
+    prev_us = rec.time_us;
+    ++nrecords;
+  }
+  if (in != stdin)
+    fclose(in);
+  fprintf(stderr, "%lu records\n", nrecords);
+  return 0;
+}
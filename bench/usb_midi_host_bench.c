@@ -0,0 +1,1521 @@
+/* 
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * This program runs the USB MIDI host driver natively on a workstation
+ * against the mock usbh layer in mock_usbh.c and reports the cost per
+ * packet or per byte of the driver's hot paths. It also checks that the
+ * data that comes out of the driver matches the data that went in, so
+ * it exits with a non-zero status if a change breaks the data path.
+ *
+ * Usage: usb_midi_host_bench [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "mock_usbh.h"
+#include "usb_midi_host.h"
+
+#define BENCH_DEV_ADDR 1
+#define BENCH_EP_SIZE 64
+#define BENCH_NUM_CABLES 1
+#define BENCH_PACKETS_PER_XFER (BENCH_EP_SIZE/4)
+#ifndef CFG_TUH_MAX_CABLES
+  #define CFG_TUH_MAX_CABLES 16 // the driver's default
+#endif
+// a second device with several cables for the multi-cable scenarios; the
+// driver refuses cables past CFG_TUH_MAX_CABLES
+#define BENCH_MULTI_ADDR 2
+#define BENCH_MULTI_CABLES TU_MIN(4, CFG_TUH_MAX_CABLES)
+// packets the RX FIFO (or the cable 0 queue) of BENCH_DEV_ADDR holds
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  #define BENCH_RX_FIFO_PACKETS (CFG_TUH_MIDI_RX_BUFSIZE/CFG_TUH_MAX_CABLES/4)
+#else
+  #define BENCH_RX_FIFO_PACKETS (CFG_TUH_MIDI_RX_BUFSIZE/4)
+#endif
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void report(const char* name, uint64_t elapsed_ns, uint64_t units, const char* unit_name)
+{
+  printf("%-28s %10.2f ns/%s (%llu %ss)\r\n", name, units ? (double)elapsed_ns/(double)units : 0.0,
+    unit_name, (unsigned long long)units, unit_name);
+}
+
+// Fill an IN transfer with Control Change messages on cable 0. The
+// controller value changes every packet so the data can be checked.
+static void fill_cc_xfer(uint8_t* xfer, uint32_t seq)
+{
+  for (int idx = 0; idx < BENCH_PACKETS_PER_XFER; idx++)
+  {
+    uint8_t* packet = xfer + idx*4;
+    packet[0] = MIDI_CIN_CONTROL_CHANGE;
+    packet[1] = 0xB0;
+    packet[2] = 7;
+    packet[3] = (uint8_t)((seq + (uint32_t)idx) & 0x7f);
+  }
+}
+
+static bool bench_rx_packet(uint32_t iterations)
+{
+  uint8_t xfer[BENCH_EP_SIZE];
+  uint64_t xfer_cb_ns = 0;
+  uint64_t read_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    fill_cc_xfer(xfer, iter);
+    uint64_t start = now_ns();
+    ok = mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, sizeof(xfer));
+    xfer_cb_ns += now_ns() - start;
+
+    uint8_t packet[4];
+    int idx = 0;
+    start = now_ns();
+    while (tuh_midi_packet_read(BENCH_DEV_ADDR, packet))
+    {
+      ok = ok && idx < BENCH_PACKETS_PER_XFER && memcmp(packet, xfer + idx*4, 4) == 0;
+      ++idx;
+    }
+    read_ns += now_ns() - start;
+    ok = ok && idx == BENCH_PACKETS_PER_XFER;
+    npackets += (uint64_t)idx;
+  }
+  report("midih_xfer_cb (IN)", xfer_cb_ns, npackets, "packet");
+  report("tuh_midi_packet_read", read_ns, npackets, "packet");
+  return ok;
+}
+
+// Same as bench_rx_packet_n() but every other packet in the transfer
+// is an all-zero filler packet that the driver must drop
+static bool bench_rx_sparse(uint32_t iterations)
+{
+  uint8_t xfer[BENCH_EP_SIZE];
+  uint8_t expected[BENCH_EP_SIZE/2];
+  uint8_t packets[BENCH_EP_SIZE];
+  uint64_t xfer_cb_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    fill_cc_xfer(xfer, iter);
+    for (int idx = 0; idx < BENCH_PACKETS_PER_XFER; idx += 2)
+    {
+      memcpy(expected + idx*2, xfer + idx*4 + 4, 4);
+      memset(xfer + idx*4, 0, 4);
+    }
+    uint64_t start = now_ns();
+    ok = mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, sizeof(xfer));
+    xfer_cb_ns += now_ns() - start;
+
+    uint32_t nread = tuh_midi_packet_read_n(BENCH_DEV_ADDR, packets, BENCH_PACKETS_PER_XFER);
+    ok = ok && nread == BENCH_PACKETS_PER_XFER/2 && memcmp(packets, expected, sizeof(expected)) == 0;
+    npackets += BENCH_PACKETS_PER_XFER;
+  }
+  report("midih_xfer_cb (IN, sparse)", xfer_cb_ns, npackets, "packet");
+  return ok;
+}
+
+static bool bench_rx_packet_n(uint32_t iterations)
+{
+  uint8_t xfer[BENCH_EP_SIZE];
+  uint8_t packets[BENCH_EP_SIZE];
+  uint64_t read_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    fill_cc_xfer(xfer, iter);
+    ok = mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, sizeof(xfer));
+
+    uint64_t start = now_ns();
+    uint32_t nread = tuh_midi_packet_read_n(BENCH_DEV_ADDR, packets, BENCH_PACKETS_PER_XFER);
+    read_ns += now_ns() - start;
+    ok = ok && nread == BENCH_PACKETS_PER_XFER && memcmp(packets, xfer, sizeof(xfer)) == 0;
+    npackets += nread;
+  }
+  report("tuh_midi_packet_read_n", read_ns, npackets, "packet");
+  return ok;
+}
+
+static bool bench_rx_packet_peek(uint32_t iterations)
+{
+  uint8_t xfer[BENCH_EP_SIZE];
+  uint64_t read_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    fill_cc_xfer(xfer, iter);
+    ok = mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, sizeof(xfer));
+
+    uint32_t idx = 0;
+    uint32_t npeeked;
+    uint8_t const* packets;
+    uint64_t start = now_ns();
+    while ((npeeked = tuh_midi_packet_peek(BENCH_DEV_ADDR, &packets)) != 0)
+    {
+      ok = ok && idx + npeeked <= BENCH_PACKETS_PER_XFER && memcmp(packets, xfer + idx*4, npeeked*4) == 0;
+      idx += npeeked;
+      tuh_midi_packet_consume(BENCH_DEV_ADDR, npeeked);
+    }
+    read_ns += now_ns() - start;
+    ok = ok && idx == BENCH_PACKETS_PER_XFER;
+    npackets += idx;
+  }
+  report("tuh_midi_packet_peek", read_ns, npackets, "packet");
+  return ok;
+}
+
+static bool bench_rx_stream(uint32_t iterations)
+{
+  uint8_t xfer[BENCH_EP_SIZE];
+  uint8_t stream[BENCH_PACKETS_PER_XFER*3];
+  uint64_t read_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    fill_cc_xfer(xfer, iter);
+    ok = mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, sizeof(xfer));
+
+    uint32_t nbytes = 0;
+    uint32_t nread = 1;
+    uint8_t cable;
+    uint64_t start = now_ns();
+    while (nread != 0 && nbytes < sizeof(stream))
+    {
+      nread = tuh_midi_stream_read(BENCH_DEV_ADDR, &cable, stream + nbytes, (uint16_t)(sizeof(stream) - nbytes));
+      nbytes += nread;
+    }
+    read_ns += now_ns() - start;
+    ok = ok && nbytes == sizeof(stream);
+    for (int idx = 0; ok && idx < BENCH_PACKETS_PER_XFER; idx++)
+    {
+      ok = memcmp(stream + idx*3, xfer + idx*4 + 1, 3) == 0;
+    }
+    npackets += BENCH_PACKETS_PER_XFER;
+  }
+  report("tuh_midi_stream_read", read_ns, npackets, "packet");
+
+  // a buffer too short for a 3 byte message is refused and reads nothing
+  uint8_t cable;
+  fill_cc_xfer(xfer, 0);
+  ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, 4) &&
+    tuh_midi_stream_read(BENCH_DEV_ADDR, &cable, stream, 2) == 0 &&
+    tuh_midi_stream_read(BENCH_DEV_ADDR, &cable, stream, 3) == 3 &&
+    memcmp(stream, xfer + 1, 3) == 0;
+  return ok;
+}
+
+static bool bench_rx_event(uint32_t iterations)
+{
+  uint8_t xfer[BENCH_EP_SIZE];
+  tuh_midi_event_t events[BENCH_PACKETS_PER_XFER];
+  uint64_t read_ns = 0;
+  uint64_t nevents = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    fill_cc_xfer(xfer, iter);
+    ok = mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, sizeof(xfer));
+
+    uint64_t const start = now_ns();
+    uint32_t const nread = tuh_midi_event_read(BENCH_DEV_ADDR, events, BENCH_PACKETS_PER_XFER);
+    read_ns += now_ns() - start;
+    ok = ok && nread == BENCH_PACKETS_PER_XFER;
+    for (int idx = 0; ok && idx < BENCH_PACKETS_PER_XFER; idx++)
+    {
+      ok = events[idx].cable_num == 0 && events[idx].type == 0xB0 && events[idx].channel == 0 &&
+        events[idx].data1 == 7 && events[idx].data2 == xfer[idx*4 + 3];
+    }
+    nevents += nread;
+  }
+  report("tuh_midi_event_read", read_ns, nevents, "packet");
+
+#if !CFG_MIDI_HOST_SYSEX_RX
+  // the SysEx end tuh_midi_event_read() skips ends the message for
+  // tuh_midi_stream_read() too, which then ignores the stray data after it
+  uint8_t const start_packet[] = {MIDI_CIN_SYSEX_START, 0xF0, 0x01, 0x02};
+  uint8_t const end_packet[] = {MIDI_CIN_SYSEX_END_3BYTE, 0x03, 0x04, 0xF7};
+  uint8_t const stray_packet[] = {MIDI_CIN_SYSEX_START, 0x05, 0x06, 0x07};
+  uint8_t stream[8];
+  uint8_t cable;
+  uint8_t packet[4];
+  ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, start_packet, sizeof(start_packet)) &&
+    tuh_midi_stream_read(BENCH_DEV_ADDR, &cable, stream, sizeof(stream)) == 3;
+  ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, end_packet, sizeof(end_packet)) &&
+    tuh_midi_event_read(BENCH_DEV_ADDR, events, BENCH_PACKETS_PER_XFER) == 0;
+  ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, stray_packet, sizeof(stray_packet)) &&
+    tuh_midi_stream_read(BENCH_DEV_ADDR, &cable, stream, sizeof(stream)) == 0 &&
+    !tuh_midi_packet_read(BENCH_DEV_ADDR, packet);
+#endif
+  return ok;
+}
+
+// Fill npackets packets with Note On messages whose data bytes count up from seq
+static void fill_seq_packets(uint8_t* packets, uint32_t seq, uint32_t npackets)
+{
+  for (uint32_t idx = 0; idx < npackets; idx++, seq++)
+  {
+    packets[idx*4] = MIDI_CIN_NOTE_ON;
+    packets[idx*4+1] = 0x90;
+    packets[idx*4+2] = (uint8_t)(seq & 0x7f);
+    packets[idx*4+3] = (uint8_t)((seq >> 7) & 0x7f);
+  }
+}
+
+// Send npackets of those Note On messages, a transfer at a time
+static bool send_seq_packets(uint32_t seq, uint32_t npackets)
+{
+  uint8_t xfer[BENCH_EP_SIZE];
+  bool ok = true;
+  while (ok && npackets)
+  {
+    uint32_t const nxfer = TU_MIN(npackets, (uint32_t)BENCH_PACKETS_PER_XFER);
+    fill_seq_packets(xfer, seq, nxfer);
+    ok = mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, (uint16_t)(nxfer*4));
+    seq += nxfer;
+    npackets -= nxfer;
+  }
+  return ok;
+}
+
+// Read npackets packets and check that each is the whole Note On message
+// fill_seq_packets() made for it, starting at seq
+static bool read_seq_packets(uint32_t seq, uint32_t npackets)
+{
+  uint8_t expected[4];
+  uint8_t packet[4];
+  bool ok = true;
+  for (uint32_t idx = 0; ok && idx < npackets; idx++)
+  {
+    fill_seq_packets(expected, seq + idx, 1);
+    ok = tuh_midi_packet_read(BENCH_DEV_ADDR, packet) && memcmp(packet, expected, 4) == 0;
+  }
+  return ok;
+}
+
+#if CFG_MIDI_HOST_STATS
+// Return true if the RX drop counters went up by exactly these amounts
+// since *p_before, and update *p_before
+static bool check_rx_drops(tuh_midi_stats_t* p_before, uint32_t dropped, uint32_t discarded, uint32_t dropped_sysex)
+{
+  tuh_midi_stats_t after;
+  bool const ok = tuh_midi_get_stats(BENCH_DEV_ADDR, &after) &&
+    after.rx_dropped_packets - p_before->rx_dropped_packets == dropped &&
+    after.rx_discarded_packets - p_before->rx_discarded_packets == discarded &&
+    after.rx_dropped_sysex - p_before->rx_dropped_sysex == dropped_sysex;
+  *p_before = after;
+  return ok;
+}
+#endif
+
+// Send two transfers more than the RX FIFO holds before reading anything.
+// Each policy must keep whole packets in order and count what it lost.
+static bool bench_rx_overflow(uint32_t iterations, tuh_midi_rx_overflow_t policy, const char* name)
+{
+  uint32_t const nsent = BENCH_RX_FIFO_PACKETS + 2*BENCH_PACKETS_PER_XFER;
+  uint32_t const nlost = nsent - BENCH_RX_FIFO_PACKETS;
+  uint64_t xfer_cb_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = tuh_midi_set_rx_overflow(BENCH_DEV_ADDR, policy);
+#if CFG_MIDI_HOST_STATS
+  tuh_midi_stats_t stats;
+  ok = ok && tuh_midi_get_stats(BENCH_DEV_ADDR, &stats);
+#endif
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    uint64_t const start = now_ns();
+    ok = send_seq_packets(iter, nsent);
+    xfer_cb_ns += now_ns() - start;
+    // the newest packets are lost unless the policy discards the oldest
+    ok = ok && read_seq_packets(policy == TUH_MIDI_RX_DROP_OLDEST ? iter + nlost : iter, BENCH_RX_FIFO_PACKETS);
+    uint8_t packet[4];
+    ok = ok && !tuh_midi_packet_read(BENCH_DEV_ADDR, packet);
+#if CFG_MIDI_HOST_STATS
+    ok = ok && (policy == TUH_MIDI_RX_DROP_OLDEST ? check_rx_drops(&stats, 0, nlost, 0) : check_rx_drops(&stats, nlost, 0, 0));
+#endif
+    npackets += nsent;
+  }
+  ok = tuh_midi_set_rx_overflow(BENCH_DEV_ADDR, TUH_MIDI_RX_DROP_NEWEST) && ok;
+  report(name, xfer_cb_ns, npackets, "packet");
+  return ok;
+}
+
+static bool bench_rx_overflow_newest(uint32_t iterations)
+{
+  return bench_rx_overflow(iterations, TUH_MIDI_RX_DROP_NEWEST, "midih_xfer_cb (drop newest)");
+}
+
+static bool bench_rx_overflow_oldest(uint32_t iterations)
+{
+  return bench_rx_overflow(iterations, TUH_MIDI_RX_DROP_OLDEST, "midih_xfer_cb (drop oldest)");
+}
+
+// With RX flow control on, the driver stops polling before the RX FIFO
+// can overflow and starts again once the application reads it down to
+// the resume level. Nothing is dropped.
+static bool bench_rx_flow_control(uint32_t iterations)
+{
+  uint16_t const resume_level = BENCH_RX_FIFO_PACKETS;  // a quarter of the FIFO, in bytes
+  uint64_t read_ns = 0;
+  uint64_t npackets = 0;
+  uint32_t seq = 0;
+  bool ok = tuh_midi_set_rx_flow_control(BENCH_DEV_ADDR, true, resume_level);
+#if CFG_MIDI_HOST_STATS
+  tuh_midi_stats_t stats;
+  ok = ok && tuh_midi_get_stats(BENCH_DEV_ADDR, &stats);
+#endif
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    // the device sends until the driver stops asking
+    uint32_t nqueued = 0;
+    while (ok && mock_usbh_in_pending(BENCH_DEV_ADDR) && nqueued < 2*BENCH_RX_FIFO_PACKETS)
+    {
+      ok = send_seq_packets(seq + nqueued, BENCH_PACKETS_PER_XFER);
+      nqueued += BENCH_PACKETS_PER_XFER;
+    }
+    ok = ok && tuh_midi_rx_paused(BENCH_DEV_ADDR) && !mock_usbh_in_pending(BENCH_DEV_ADDR);
+    ok = ok && nqueued <= BENCH_RX_FIFO_PACKETS;
+
+    // polling restarts once no more than resume_level bytes are queued
+    uint64_t const start = now_ns();
+    for (uint32_t nread = 0; ok && nread < nqueued; nread++)
+    {
+      ok = read_seq_packets(seq + nread, 1);
+      bool const resumed = (nqueued - nread - 1)*4 <= resume_level;
+      ok = ok && mock_usbh_in_pending(BENCH_DEV_ADDR) == resumed && tuh_midi_rx_paused(BENCH_DEV_ADDR) == !resumed;
+    }
+    read_ns += now_ns() - start;
+#if CFG_MIDI_HOST_STATS
+    ok = ok && check_rx_drops(&stats, 0, 0, 0);
+#endif
+    seq += nqueued;
+    npackets += nqueued;
+  }
+  ok = tuh_midi_set_rx_flow_control(BENCH_DEV_ADDR, false, 0) && ok;
+  report("tuh_midi_packet_read (flow)", read_ns, npackets, "packet");
+  return ok;
+}
+
+#if !CFG_MIDI_HOST_SYSEX_RX
+// Fill packets with the part of a SysEx message of len bytes that starts
+// at byte pos: 0xF0, data bytes counting up, 0xF7
+static uint32_t fill_sysex_packets(uint8_t* packets, uint32_t pos, uint32_t len, uint32_t npackets)
+{
+  uint32_t idx = 0;
+  for (; idx < npackets && pos < len; idx++)
+  {
+    uint32_t const left = len - pos;
+    packets[idx*4] = left > 3 ? MIDI_CIN_SYSEX_START : (uint8_t)(MIDI_CIN_SYSEX_END_1BYTE + left - 1);
+    for (uint32_t byte = 0; byte < 3; byte++, pos++)
+    {
+      uint8_t data = (uint8_t)(pos & 0x7f);
+      if (pos == 0)
+        data = MIDI_STATUS_SYSEX_START;
+      else if (pos == len - 1)
+        data = MIDI_STATUS_SYSEX_END;
+      else if (pos >= len)
+        data = 0;
+      packets[idx*4 + 1 + byte] = data;
+    }
+  }
+  return idx;
+}
+
+// With TUH_MIDI_RX_DROP_SYSEX, a SysEx message that loses a packet loses
+// the rest of it too, even after the application makes room, while the
+// messages around it are kept
+static bool bench_rx_overflow_sysex(uint32_t iterations)
+{
+  // a 20 packet message; the first 16 packets just fit
+  uint32_t const len = 20*3;
+  uint8_t xfer[BENCH_EP_SIZE];
+  uint8_t sysex[BENCH_EP_SIZE];
+  uint8_t packet[4];
+  uint64_t xfer_cb_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = tuh_midi_set_rx_overflow(BENCH_DEV_ADDR, TUH_MIDI_RX_DROP_SYSEX);
+#if CFG_MIDI_HOST_STATS
+  tuh_midi_stats_t stats;
+  ok = ok && tuh_midi_get_stats(BENCH_DEV_ADDR, &stats);
+#endif
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    uint32_t const nnotes = BENCH_RX_FIFO_PACKETS - BENCH_PACKETS_PER_XFER;
+    uint64_t const start = now_ns();
+    ok = send_seq_packets(iter, nnotes);
+    fill_sysex_packets(sysex, 0, len, BENCH_PACKETS_PER_XFER);
+    ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, sysex, sizeof(sysex));
+    // no room for the next 2 packets of the message
+    fill_sysex_packets(xfer, 16*3, len, 2);
+    ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, 2*4);
+    xfer_cb_ns += now_ns() - start;
+    ok = ok && read_seq_packets(iter, nnotes);
+    for (uint32_t idx = 0; ok && idx < BENCH_PACKETS_PER_XFER; idx++)
+    {
+      ok = tuh_midi_packet_read(BENCH_DEV_ADDR, packet) && memcmp(packet, sysex + idx*4, 4) == 0;
+    }
+    ok = ok && !tuh_midi_packet_read(BENCH_DEV_ADDR, packet);
+
+    // the end of the message is dropped even though it fits now, but
+    // the note after it is not
+    uint32_t const nend = fill_sysex_packets(xfer, 18*3, len, 2);
+    fill_seq_packets(xfer + nend*4, iter, 1);
+    ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, (uint16_t)((nend + 1)*4));
+    ok = ok && read_seq_packets(iter, 1) && !tuh_midi_packet_read(BENCH_DEV_ADDR, packet);
+
+    // and the next message arrives whole
+    uint32_t const nshort = fill_sysex_packets(xfer, 0, 6, BENCH_PACKETS_PER_XFER);
+    ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, (uint16_t)(nshort*4));
+    for (uint32_t idx = 0; ok && idx < nshort; idx++)
+    {
+      ok = tuh_midi_packet_read(BENCH_DEV_ADDR, packet) && memcmp(packet, xfer + idx*4, 4) == 0;
+    }
+    ok = ok && !tuh_midi_packet_read(BENCH_DEV_ADDR, packet);
+#if CFG_MIDI_HOST_STATS
+    ok = ok && check_rx_drops(&stats, 2 + nend, 0, 1);
+#endif
+    npackets += nnotes + 20 + 1 + nshort;
+  }
+  ok = tuh_midi_set_rx_overflow(BENCH_DEV_ADDR, TUH_MIDI_RX_DROP_NEWEST) && ok;
+  report("midih_xfer_cb (drop sysex)", xfer_cb_ns, npackets, "packet");
+  return ok;
+}
+#endif
+
+// Real-time messages the driver passed to tuh_midi_rt_cb(). A scenario
+// that sends them sets rt_expected to what it should see, in order.
+static uint8_t const* rt_expected;
+static uint32_t rt_count;
+static bool rt_ok = true;
+// if set, tuh_midi_rt_cb() calls this while the driver is in midih_xfer_cb()
+static void (*rt_hook)(void);
+
+void tuh_midi_rt_cb(uint8_t dev_addr, uint8_t cable_num, uint8_t status)
+{
+  rt_ok = rt_ok && rt_expected != NULL && dev_addr == BENCH_DEV_ADDR && cable_num == 0 &&
+    status == rt_expected[rt_count];
+  ++rt_count;
+  if (rt_hook)
+  {
+    rt_hook();
+  }
+}
+
+// Every other packet is a real-time message. tuh_midi_rt_cb() must see
+// each one, and unless CFG_MIDI_HOST_RX_RT_FIFO is 1 they must not
+// reach the RX FIFO.
+static bool bench_rx_rt_cb(uint32_t iterations)
+{
+  static const uint8_t rt_status[] = {
+    MIDI_STATUS_SYSREAL_TIMING_CLOCK, MIDI_STATUS_SYSREAL_START,
+    MIDI_STATUS_SYSREAL_CONTINUE, MIDI_STATUS_SYSREAL_STOP,
+  };
+  uint8_t xfer[BENCH_EP_SIZE];
+  uint8_t expected[BENCH_PACKETS_PER_XFER/2];
+  uint8_t packets[BENCH_EP_SIZE];
+  uint64_t xfer_cb_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = true;
+  rt_expected = expected;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    fill_cc_xfer(xfer, iter);
+    for (int idx = 0; idx < BENCH_PACKETS_PER_XFER; idx += 2)
+    {
+      uint8_t* packet = xfer + idx*4;
+      expected[idx/2] = rt_status[(iter + (uint32_t)idx/2) % TU_ARRAY_SIZE(rt_status)];
+      packet[0] = MIDI_CIN_1BYTE_DATA;
+      packet[1] = expected[idx/2];
+      packet[2] = 0;
+      packet[3] = 0;
+    }
+    rt_count = 0;
+    uint64_t const start = now_ns();
+    ok = mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, sizeof(xfer));
+    xfer_cb_ns += now_ns() - start;
+    ok = ok && rt_ok && rt_count == BENCH_PACKETS_PER_XFER/2;
+
+    uint32_t const nread = tuh_midi_packet_read_n(BENCH_DEV_ADDR, packets, BENCH_PACKETS_PER_XFER);
+#if CFG_MIDI_HOST_RX_RT_FIFO
+    ok = ok && nread == BENCH_PACKETS_PER_XFER && memcmp(packets, xfer, sizeof(xfer)) == 0;
+#else
+    ok = ok && nread == BENCH_PACKETS_PER_XFER/2;
+    for (uint32_t idx = 0; ok && idx < nread; idx++)
+    {
+      ok = memcmp(packets + idx*4, xfer + idx*8 + 4, 4) == 0;
+    }
+#endif
+    npackets += BENCH_PACKETS_PER_XFER;
+  }
+  rt_expected = NULL;
+  report("midih_xfer_cb (IN, rt_cb)", xfer_cb_ns, npackets, "packet");
+  return ok;
+}
+
+// The next transfer's data for bench_rx_ping_pong(), and whether the
+// next IN transfer was already queued when the driver called back
+static uint8_t ping_pong_next[BENCH_EP_SIZE];
+static bool ping_pong_ok;
+
+static void ping_pong_fill(void)
+{
+  // the host controller writes the next transfer while the driver is
+  // still working on this one
+  ping_pong_ok = mock_usbh_in_pending(BENCH_DEV_ADDR) &&
+    mock_usbh_in_fill(BENCH_DEV_ADDR, ping_pong_next, sizeof(ping_pong_next));
+}
+
+// The driver must queue the next IN transfer before it processes the
+// packets of the one that completed, and in the other buffer, so the
+// data that arrives meanwhile does not overwrite packets not yet queued.
+// The last packet of each transfer is a MIDI clock so tuh_midi_rt_cb()
+// can look at the endpoint in the middle of midih_xfer_cb().
+static bool bench_rx_ping_pong(uint32_t iterations)
+{
+  static const uint8_t clock = MIDI_STATUS_SYSREAL_TIMING_CLOCK;
+  uint8_t xfer[BENCH_EP_SIZE];
+  uint8_t packets[BENCH_EP_SIZE];
+  uint64_t xfer_cb_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = true;
+  rt_expected = &clock;
+  rt_hook = ping_pong_fill;
+  fill_cc_xfer(xfer, 0);
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    uint8_t* packet = xfer + sizeof(xfer) - 4;
+    packet[0] = MIDI_CIN_1BYTE_DATA;
+    packet[1] = MIDI_STATUS_SYSREAL_TIMING_CLOCK;
+    packet[2] = 0;
+    packet[3] = 0;
+    fill_cc_xfer(ping_pong_next, iter + 1);
+    rt_count = 0;
+    ping_pong_ok = false;
+    uint64_t const start = now_ns();
+    ok = mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, sizeof(xfer));
+    xfer_cb_ns += now_ns() - start;
+    ok = ok && ping_pong_ok && rt_ok && rt_count == 1;
+
+    uint32_t const nread = tuh_midi_packet_read_n(BENCH_DEV_ADDR, packets, BENCH_PACKETS_PER_XFER);
+    ok = ok && nread == BENCH_PACKETS_PER_XFER - 1 + CFG_MIDI_HOST_RX_RT_FIFO && memcmp(packets, xfer, nread*4) == 0;
+    // the next iteration completes the transfer the hook filled
+    memcpy(xfer, ping_pong_next, sizeof(xfer));
+    npackets += BENCH_PACKETS_PER_XFER;
+  }
+  rt_hook = NULL;
+  rt_expected = NULL;
+  // finish the last transfer the hook filled
+  ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, ping_pong_next, 0);
+  report("midih_xfer_cb (IN, ping-pong)", xfer_cb_ns, npackets, "packet");
+  return ok;
+}
+
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+// The device interleaves Note On packets for all of its cables; each
+// cable's queue must hold only its own packets, in the order they came
+static bool bench_rx_cable_queues(uint32_t iterations)
+{
+  uint8_t xfer[BENCH_EP_SIZE];
+  uint8_t stream[BENCH_PACKETS_PER_XFER*3];
+  uint64_t read_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    for (int idx = 0; idx < BENCH_PACKETS_PER_XFER; idx++)
+    {
+      uint8_t* packet = xfer + idx*4;
+      packet[0] = (uint8_t)(((idx % BENCH_MULTI_CABLES) << 4) | MIDI_CIN_NOTE_ON);
+      packet[1] = 0x90;
+      packet[2] = (uint8_t)((iter + (uint32_t)idx) & 0x7f);
+      packet[3] = 100;
+    }
+    ok = mock_usbh_in_xfer(BENCH_MULTI_ADDR, xfer, sizeof(xfer));
+
+    // read the cables in reverse so a shared queue would show up
+    uint64_t const start = now_ns();
+    for (int cable = BENCH_MULTI_CABLES - 1; ok && cable >= 0; cable--)
+    {
+      uint32_t const nread = tuh_midi_stream_read_cable(BENCH_MULTI_ADDR, (uint8_t)cable, stream, sizeof(stream));
+      ok = nread == 3*BENCH_PACKETS_PER_XFER/BENCH_MULTI_CABLES;
+      for (uint32_t idx = 0; ok && idx < nread/3; idx++)
+      {
+        ok = memcmp(stream + idx*3, xfer + (idx*BENCH_MULTI_CABLES + (uint32_t)cable)*4 + 1, 3) == 0;
+      }
+    }
+    read_ns += now_ns() - start;
+    uint8_t cable;
+    ok = ok && tuh_midi_stream_read(BENCH_MULTI_ADDR, &cable, stream, sizeof(stream)) == 0;
+    npackets += BENCH_PACKETS_PER_XFER;
+  }
+  report("tuh_midi_stream_read_cable", read_ns, npackets, "packet");
+  return ok;
+}
+#endif
+
+#if CFG_MIDI_HOST_SYSEX_RX
+static uint32_t sysex_rx_len;
+static bool sysex_rx_ok;
+static bool sysex_rx_truncated;
+static uint32_t sysex_rx_count;
+static uint8_t sysex_rx_head[8]; // the start of the last message
+
+void tuh_midi_sysex_cb(uint8_t dev_addr, uint8_t cable_num, uint8_t const* data, uint32_t len, bool truncated)
+{
+  (void) dev_addr;
+  sysex_rx_truncated = truncated;
+  sysex_rx_count++;
+  memcpy(sysex_rx_head, data, TU_MIN(len, sizeof(sysex_rx_head)));
+  // the message bench_rx_sysex() sends: 0xF0, data bytes counting up, 0xF7
+  sysex_rx_ok = cable_num == 0 && !truncated && len >= 2 && data[0] == 0xF0 && data[len-1] == 0xF7;
+  for (uint32_t idx = 1; sysex_rx_ok && idx < len - 1; idx++)
+  {
+    sysex_rx_ok = data[idx] == (uint8_t)(idx & 0x7f);
+  }
+  sysex_rx_len = len;
+}
+
+static bool bench_rx_sysex(uint32_t iterations)
+{
+  // a 2 transfer message that fits in the default reassembly buffer
+  uint8_t xfer[2][BENCH_EP_SIZE];
+  uint32_t const len = BENCH_PACKETS_PER_XFER * 2 * 3;
+  for (uint32_t idx = 0; idx < len; idx += 3)
+  {
+    uint8_t* packet = &xfer[idx / (BENCH_PACKETS_PER_XFER*3)][(idx % (BENCH_PACKETS_PER_XFER*3)) / 3 * 4];
+    packet[0] = idx + 3 < len ? MIDI_CIN_SYSEX_START : MIDI_CIN_SYSEX_END_3BYTE;
+    for (uint32_t byte = 0; byte < 3; byte++)
+    {
+      packet[1 + byte] = (uint8_t)((idx + byte) & 0x7f);
+    }
+  }
+  xfer[0][1] = 0xF0;
+  xfer[1][BENCH_EP_SIZE-1] = 0xF7;
+  uint64_t rx_ns = 0;
+  uint64_t nbytes = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    sysex_rx_len = 0;
+    uint64_t const start = now_ns();
+    ok = mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer[0], BENCH_EP_SIZE) && mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer[1], BENCH_EP_SIZE);
+    rx_ns += now_ns() - start;
+    // none of the message reaches the RX FIFO
+    uint8_t packet[4];
+    ok = ok && sysex_rx_ok && sysex_rx_len == len && !tuh_midi_packet_read(BENCH_DEV_ADDR, packet);
+    nbytes += len;
+  }
+  report("midih_xfer_cb (sysex)", rx_ns, nbytes, "byte");
+
+  // the status bytes end a message, not the CIN: 0xF7 in a 3 byte SysEx packet
+  uint8_t const cin_start_end[] = {
+    MIDI_CIN_SYSEX_START, 0xF0, 0x01, 0x02,
+    MIDI_CIN_SYSEX_START, 0x03, 0xF7, 0x00,
+  };
+  uint8_t const want_complete[] = {0xF0, 0x01, 0x02, 0x03, 0xF7};
+  uint8_t packet[4];
+  sysex_rx_count = 0;
+  ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, cin_start_end, sizeof(cin_start_end));
+  ok = ok && sysex_rx_count == 1 && !sysex_rx_truncated && sysex_rx_len == sizeof(want_complete) &&
+    memcmp(sysex_rx_head, want_complete, sizeof(want_complete)) == 0 &&
+    !tuh_midi_packet_read(BENCH_DEV_ADDR, packet);
+
+  // a Tune Request cuts the message short; what follows it is no SysEx
+  uint8_t const cut_short[] = {
+    MIDI_CIN_SYSEX_START, 0xF0, 0x01, 0x02,
+    MIDI_CIN_SYSEX_END_1BYTE, 0xF6, 0x00, 0x00,
+    MIDI_CIN_SYSEX_END_3BYTE, 0x03, 0x04, 0xF7,
+  };
+  sysex_rx_count = 0;
+  ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, cut_short, sizeof(cut_short));
+  ok = ok && sysex_rx_count == 1 && sysex_rx_truncated && sysex_rx_len == 3 &&
+    memcmp(sysex_rx_head, cut_short + 1, 3) == 0;
+  ok = ok && tuh_midi_packet_read(BENCH_DEV_ADDR, packet) && memcmp(packet, cut_short + 4, 4) == 0;
+  ok = ok && tuh_midi_packet_read(BENCH_DEV_ADDR, packet) && memcmp(packet, cut_short + 8, 4) == 0;
+  ok = ok && !tuh_midi_packet_read(BENCH_DEV_ADDR, packet) && sysex_rx_count == 1;
+  return ok;
+}
+#endif
+
+#if CFG_MIDI_HOST_RX_FILTER
+static bool bench_rx_filter(uint32_t iterations)
+{
+  // every other packet is a MIDI clock the filter drops
+  uint8_t xfer[BENCH_EP_SIZE];
+  fill_cc_xfer(xfer, 0);
+  for (int idx = 0; idx < BENCH_PACKETS_PER_XFER; idx += 2)
+  {
+    uint8_t* packet = &xfer[idx*4];
+    packet[0] = MIDI_CIN_1BYTE_DATA;
+    packet[1] = MIDI_STATUS_SYSREAL_TIMING_CLOCK;
+    packet[2] = 0;
+    packet[3] = 0;
+  }
+  bool ok = tuh_midi_set_rx_filter(BENCH_DEV_ADDR, 0, TUH_MIDI_FILTER_CLOCK, 0);
+  uint8_t packets[BENCH_EP_SIZE];
+  uint64_t rx_ns = 0;
+  uint64_t npackets = 0;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    uint64_t const start = now_ns();
+    ok = mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, sizeof(xfer));
+    rx_ns += now_ns() - start;
+    // only the control changes reach the RX FIFO
+    uint32_t const nread = tuh_midi_packet_read_n(BENCH_DEV_ADDR, packets, BENCH_PACKETS_PER_XFER);
+    ok = ok && nread == BENCH_PACKETS_PER_XFER / 2 && packets[1] == 0xB0 && packets[5] == 0xB0;
+    npackets += BENCH_PACKETS_PER_XFER;
+  }
+  ok = tuh_midi_set_rx_filter(BENCH_DEV_ADDR, 0, 0, 0) && ok;
+  report("midih_xfer_cb (filter)", rx_ns, npackets, "packet");
+
+  // a cable the device does not have has no filter; its packets go on as
+  // they are, unless there is no RX cable queue to put them in
+  uint8_t const stray_clock[] = {0xF0 | MIDI_CIN_1BYTE_DATA, MIDI_STATUS_SYSREAL_TIMING_CLOCK, 0, 0};
+  ok = ok && tuh_midi_set_rx_filter(BENCH_DEV_ADDR, TUH_MIDI_ALL_CABLES, TUH_MIDI_FILTER_CLOCK, 0) &&
+    mock_usbh_in_xfer(BENCH_DEV_ADDR, stray_clock, sizeof(stray_clock));
+  uint32_t const nstray = tuh_midi_packet_read_n(BENCH_DEV_ADDR, packets, BENCH_PACKETS_PER_XFER);
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  ok = ok && nstray <= 1;
+#else
+  ok = ok && nstray == 1;
+#endif
+  ok = ok && (nstray == 0 || memcmp(packets, stray_clock, sizeof(stray_clock)) == 0);
+  ok = tuh_midi_set_rx_filter(BENCH_DEV_ADDR, TUH_MIDI_ALL_CABLES, 0, 0) && ok;
+  return ok;
+}
+#endif
+
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+static bool bench_rx_stream_ts(uint32_t iterations)
+{
+  uint8_t xfer[2][BENCH_EP_SIZE];
+  uint8_t stream[BENCH_PACKETS_PER_XFER*3];
+  uint64_t read_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    // two transfers that arrive 1 ms apart and are read later
+    uint32_t const t0 = mock_usbh_time_us();
+    fill_cc_xfer(xfer[0], iter);
+    ok = mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer[0], sizeof(xfer[0]));
+    mock_usbh_advance_us(1000);
+    fill_cc_xfer(xfer[1], iter + 1);
+    ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer[1], sizeof(xfer[1]));
+    mock_usbh_advance_us(5000);
+
+    for (int xfer_idx = 0; ok && xfer_idx < 2; xfer_idx++)
+    {
+      // each transfer comes back on its own with its own arrival time
+      uint32_t timestamp = 0;
+      uint8_t cable;
+      uint64_t const start = now_ns();
+      uint32_t const nbytes = tuh_midi_stream_read_ts(BENCH_DEV_ADDR, &cable, stream, sizeof(stream), &timestamp);
+      read_ns += now_ns() - start;
+      ok = nbytes == sizeof(stream) && timestamp == t0 + 1000u * (uint32_t)xfer_idx;
+      for (int idx = 0; ok && idx < BENCH_PACKETS_PER_XFER; idx++)
+      {
+        ok = memcmp(stream + idx*3, xfer[xfer_idx] + idx*4 + 1, 3) == 0;
+      }
+    }
+    npackets += 2*BENCH_PACKETS_PER_XFER;
+  }
+  report("tuh_midi_stream_read_ts", read_ns, npackets, "packet");
+  return ok;
+}
+#endif
+
+static bool bench_tx_stream(uint32_t iterations)
+{
+  // Note On/Note Off pairs with running status every other message
+  static const uint8_t msgs[] = {0x90, 60, 100, 61, 100, 0x80, 60, 0, 61, 0};
+  uint8_t sent[BENCH_EP_SIZE];
+  uint64_t write_ns = 0;
+  uint64_t flush_ns = 0;
+  uint64_t nbytes = 0;
+  uint64_t npackets = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    uint64_t start = now_ns();
+    uint32_t nwritten = tuh_midi_stream_write(BENCH_DEV_ADDR, 0, msgs, sizeof(msgs));
+    write_ns += now_ns() - start;
+    ok = nwritten == sizeof(msgs);
+    nbytes += nwritten;
+
+    start = now_ns();
+    uint32_t nflushed = tuh_midi_stream_flush(BENCH_DEV_ADDR);
+    flush_ns += now_ns() - start;
+    uint16_t xferred = mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent));
+    ok = ok && nflushed == 16 && xferred == 16;
+    ok = ok && sent[0] == MIDI_CIN_NOTE_ON && sent[1] == 0x90 && sent[2] == 60 && sent[3] == 100;
+    ok = ok && sent[4] == MIDI_CIN_NOTE_ON && sent[5] == 0x90 && sent[6] == 61 && sent[7] == 100;
+    ok = ok && sent[8] == MIDI_CIN_NOTE_OFF && sent[9] == 0x80 && sent[10] == 60 && sent[11] == 0;
+    ok = ok && sent[12] == MIDI_CIN_NOTE_OFF && sent[13] == 0x80 && sent[14] == 61 && sent[15] == 0;
+    npackets += 4;
+  }
+  report("tuh_midi_stream_write", write_ns, nbytes, "byte");
+  report("tuh_midi_stream_flush", flush_ns, npackets, "packet");
+  return ok;
+}
+
+// Queue more than one transfer's worth of notes, then a MIDI clock with
+// tuh_midi_packet_write_priority(). The clock must go out first.
+static bool bench_tx_priority(uint32_t iterations)
+{
+  static const uint8_t clock[4] = {MIDI_CIN_1BYTE_DATA, MIDI_STATUS_SYSREAL_TIMING_CLOCK, 0, 0};
+  uint32_t const nnotes = BENCH_PACKETS_PER_XFER + BENCH_PACKETS_PER_XFER/2;
+  uint8_t notes[(BENCH_PACKETS_PER_XFER + BENCH_PACKETS_PER_XFER/2)*4];
+  uint8_t expected[sizeof(notes) + 4];
+  uint8_t sent[sizeof(expected)];
+  for (uint32_t idx = 0; idx < nnotes; idx++)
+  {
+    notes[idx*4] = MIDI_CIN_NOTE_ON;
+    notes[idx*4+1] = 0x90;
+    notes[idx*4+2] = (uint8_t)(36 + idx);
+    notes[idx*4+3] = 100;
+  }
+#if defined(CFG_TUH_MIDI_TX_RT_BUFSIZE) && CFG_TUH_MIDI_TX_RT_BUFSIZE == 0
+  // without the real-time lane the clock waits in line
+  memcpy(expected, notes, sizeof(notes));
+  memcpy(expected + sizeof(notes), clock, 4);
+#else
+  memcpy(expected, clock, 4);
+  memcpy(expected + 4, notes, sizeof(notes));
+#endif
+  uint64_t write_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    ok = tuh_midi_packet_write_n(BENCH_DEV_ADDR, notes, nnotes) == nnotes;
+    uint64_t const start = now_ns();
+    ok = ok && tuh_midi_packet_write_priority(BENCH_DEV_ADDR, clock);
+    write_ns += now_ns() - start;
+    tuh_midi_stream_flush(BENCH_DEV_ADDR);
+    uint32_t nsent = 0;
+    while (ok && mock_usbh_out_pending(BENCH_DEV_ADDR))
+    {
+      nsent += mock_usbh_out_xfer(BENCH_DEV_ADDR, sent + nsent, (uint16_t)(sizeof(sent) - nsent));
+    }
+    ok = ok && nsent == sizeof(expected) && memcmp(sent, expected, sizeof(expected)) == 0;
+    npackets++;
+  }
+  report("tuh_midi_packet_write_priority", write_ns, npackets, "packet");
+
+  // a clock queued while a transfer is on the bus and the next one is
+  // already packed full still goes out in the next transfer
+  uint32_t const nbusy = 2*BENCH_PACKETS_PER_XFER + BENCH_PACKETS_PER_XFER/2;
+  uint8_t busy_notes[(2*BENCH_PACKETS_PER_XFER + BENCH_PACKETS_PER_XFER/2)*4];
+  uint8_t busy_sent[sizeof(busy_notes) + 4];
+  for (uint32_t idx = 0; idx < nbusy; idx++)
+  {
+    memcpy(busy_notes + idx*4, notes, 4);
+    busy_notes[idx*4+2] = (uint8_t)(36 + idx);
+  }
+  uint32_t nsent = 0;
+  ok = ok && tuh_midi_packet_write_n(BENCH_DEV_ADDR, busy_notes, nbusy) == nbusy &&
+    tuh_midi_stream_flush(BENCH_DEV_ADDR) == BENCH_EP_SIZE &&
+    tuh_midi_packet_write_priority(BENCH_DEV_ADDR, clock);
+  while (ok && mock_usbh_out_pending(BENCH_DEV_ADDR))
+  {
+    nsent += mock_usbh_out_xfer(BENCH_DEV_ADDR, busy_sent + nsent, (uint16_t)(sizeof(busy_sent) - nsent));
+  }
+#if defined(CFG_TUH_MIDI_TX_RT_BUFSIZE) && CFG_TUH_MIDI_TX_RT_BUFSIZE == 0
+  ok = ok && nsent == sizeof(busy_sent) && memcmp(busy_sent, busy_notes, sizeof(busy_notes)) == 0 &&
+    memcmp(busy_sent + sizeof(busy_notes), clock, 4) == 0;
+#else
+  ok = ok && nsent == sizeof(busy_sent) && memcmp(busy_sent, busy_notes, BENCH_EP_SIZE) == 0 &&
+    memcmp(busy_sent + BENCH_EP_SIZE, clock, 4) == 0 &&
+    memcmp(busy_sent + BENCH_EP_SIZE + 4, busy_notes + BENCH_EP_SIZE, sizeof(busy_notes) - BENCH_EP_SIZE) == 0;
+#endif
+  return ok;
+}
+
+// Flush while an OUT transfer is on the bus: the driver packs the next
+// transfer right away and sends it, then the rest, when the first completes
+static bool bench_tx_staging(uint32_t iterations)
+{
+  uint32_t const npackets_total = 2*BENCH_PACKETS_PER_XFER + 4;
+  uint8_t packets[(2*BENCH_PACKETS_PER_XFER + 4)*4];
+  uint8_t sent[BENCH_EP_SIZE];
+  uint64_t stage_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    for (uint32_t idx = 0; idx < npackets_total; idx++)
+    {
+      packets[idx*4] = MIDI_CIN_NOTE_ON;
+      packets[idx*4+1] = 0x90;
+      packets[idx*4+2] = (uint8_t)((iter + idx) & 0x7f);
+      packets[idx*4+3] = 100;
+    }
+    ok = tuh_midi_packet_write_n(BENCH_DEV_ADDR, packets, BENCH_PACKETS_PER_XFER) == BENCH_PACKETS_PER_XFER;
+    ok = ok && tuh_midi_stream_flush(BENCH_DEV_ADDR) == BENCH_EP_SIZE && mock_usbh_out_pending(BENCH_DEV_ADDR);
+
+    // the endpoint is busy, so this flush only stages the next transfer
+    ok = ok && tuh_midi_packet_write_n(BENCH_DEV_ADDR, packets + BENCH_EP_SIZE, npackets_total - BENCH_PACKETS_PER_XFER) ==
+      npackets_total - BENCH_PACKETS_PER_XFER;
+    uint64_t const start = now_ns();
+    ok = ok && tuh_midi_stream_flush(BENCH_DEV_ADDR) == 0;
+    stage_ns += now_ns() - start;
+
+    ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent)) == BENCH_EP_SIZE && memcmp(sent, packets, BENCH_EP_SIZE) == 0;
+    ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent)) == BENCH_EP_SIZE && memcmp(sent, packets + BENCH_EP_SIZE, BENCH_EP_SIZE) == 0;
+    ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent)) == 16 && memcmp(sent, packets + 2*BENCH_EP_SIZE, 16) == 0;
+    ok = ok && !mock_usbh_out_pending(BENCH_DEV_ADDR);
+    npackets += npackets_total - BENCH_PACKETS_PER_XFER;
+  }
+  report("tuh_midi_stream_flush (busy)", stage_ns, npackets, "packet");
+  return ok;
+}
+
+// The byte at a time encoder tuh_midi_stream_write() used before it
+// was rewritten, kept as the reference for bench_tx_stream_encoder().
+// Real-time bytes are left out because the driver now sends them on
+// the priority lane instead of in stream order.
+typedef struct
+{
+  uint8_t buffer[4];
+  uint8_t index;
+  uint8_t total;
+} ref_stream_t;
+
+static uint32_t ref_stream_write(ref_stream_t* stream, uint8_t cable_num, uint8_t const* buffer, uint32_t bufsize, uint8_t* packets)
+{
+  uint8_t const CN_ = (uint8_t)(cable_num << 4);
+  uint32_t npackets = 0;
+  for (uint32_t i = 0; i < bufsize; i++)
+  {
+    uint8_t const data = buffer[i];
+    if (stream->index == 0)
+    {
+      uint8_t const msg = data >> 4;
+      uint8_t const _msg = stream->buffer[0] & 0x0F;
+      stream->index = 2;
+      stream->total = 4;
+      if (_msg == MIDI_CIN_SYSEX_START)
+      {
+        stream->buffer[1] = data;
+        if (data == MIDI_STATUS_SYSEX_END)
+        {
+          stream->buffer[0] = CN_ + MIDI_CIN_SYSEX_END_1BYTE;
+          stream->total = 2;
+        }
+      }
+      else if (msg < 0x8 && _msg >= 0x8 && _msg < 0xF)
+      {
+        // running status
+        stream->buffer[2] = data;
+        stream->index = 3;
+        if (_msg == 0xC || _msg == 0xD)
+        {
+          stream->total = 3;
+        }
+      }
+      else if ((msg >= 0x8 && msg <= 0xB) || msg == 0xE)
+      {
+        stream->buffer[1] = data;
+        stream->buffer[0] = CN_ + msg;
+      }
+      else if (msg == 0xC || msg == 0xD)
+      {
+        stream->buffer[1] = data;
+        stream->buffer[0] = CN_ + msg;
+        stream->total = 3;
+      }
+      else if (msg == 0xf)
+      {
+        stream->buffer[1] = data;
+        if (data == MIDI_STATUS_SYSEX_START)
+        {
+          stream->buffer[0] = CN_ + MIDI_CIN_SYSEX_START;
+        }
+        else if (data == MIDI_STATUS_SYSCOM_TIME_CODE_QUARTER_FRAME || data == MIDI_STATUS_SYSCOM_SONG_SELECT)
+        {
+          stream->buffer[0] = CN_ + MIDI_CIN_SYSCOM_2BYTE;
+          stream->total = 3;
+        }
+        else if (data == MIDI_STATUS_SYSCOM_SONG_POSITION_POINTER)
+        {
+          stream->buffer[0] = CN_ + MIDI_CIN_SYSCOM_3BYTE;
+        }
+        else
+        {
+          stream->buffer[0] = CN_ + MIDI_CIN_1BYTE_DATA;
+          stream->total = 2;
+        }
+      }
+      else
+      {
+        stream->buffer[1] = data;
+        stream->buffer[0] = CN_ + 0xF;
+        stream->total = 2;
+      }
+    }
+    else
+    {
+      stream->buffer[stream->index] = data;
+      stream->index++;
+      if (stream->buffer[0] == CN_ + MIDI_CIN_SYSEX_START && data == MIDI_STATUS_SYSEX_END)
+      {
+        stream->buffer[0] = (uint8_t)(CN_ + MIDI_CIN_SYSEX_START + (stream->index - 1));
+        stream->total = stream->index;
+      }
+    }
+
+    if (stream->index >= 2 && stream->index >= stream->total)
+    {
+      for (uint8_t idx = stream->total; idx < 4; idx++) stream->buffer[idx] = 0;
+      memcpy(packets + npackets*4, stream->buffer, 4);
+      npackets++;
+      stream->index = 0;
+    }
+  }
+  return npackets;
+}
+
+// Feed random byte streams on random cables through tuh_midi_stream_write()
+// and check that every packet matches what the reference encoder makes
+static bool bench_tx_stream_encoder(uint32_t iterations)
+{
+  ref_stream_t ref[BENCH_MULTI_CABLES];
+  uint8_t chunk[32];
+  uint8_t expected[sizeof(chunk)*4];
+  uint8_t sent[sizeof(expected)];
+  uint64_t write_ns = 0;
+  uint64_t nbytes = 0;
+  bool ok = true;
+  memset(ref, 0, sizeof(ref));
+  srand(1);
+  for (uint32_t iter = 0; iter < 16*iterations && ok; iter++)
+  {
+    uint32_t const len = 1 + (uint32_t)rand() % sizeof(chunk);
+    uint8_t const cable = (uint8_t)(rand() % BENCH_MULTI_CABLES);
+    for (uint32_t idx = 0; idx < len; idx++)
+    {
+      int const kind = rand() % 20;
+      if (kind < 11)
+        chunk[idx] = (uint8_t)(rand() & 0x7f);
+      else if (kind < 16)
+        chunk[idx] = (uint8_t)(0x80 + rand() % 0x70);
+      else if (kind < 17)
+        chunk[idx] = MIDI_STATUS_SYSEX_START;
+      else if (kind < 19)
+        chunk[idx] = MIDI_STATUS_SYSEX_END;
+      else
+        chunk[idx] = (uint8_t)(0xF1 + rand() % 6);
+    }
+    uint32_t const nexpected = 4*ref_stream_write(&ref[cable], cable, chunk, len, expected);
+
+    uint64_t const start = now_ns();
+    uint32_t const nwritten = tuh_midi_stream_write(BENCH_MULTI_ADDR, cable, chunk, len);
+    write_ns += now_ns() - start;
+    nbytes += nwritten;
+    ok = nwritten == len;
+    tuh_midi_stream_flush(BENCH_MULTI_ADDR);
+    uint32_t nsent = 0;
+    while (ok && mock_usbh_out_pending(BENCH_MULTI_ADDR))
+    {
+      nsent += mock_usbh_out_xfer(BENCH_MULTI_ADDR, sent + nsent, (uint16_t)(sizeof(sent) - nsent));
+    }
+    ok = ok && nsent == nexpected && memcmp(sent, expected, nexpected) == 0;
+  }
+  report("tuh_midi_stream_write (rand)", write_ns, nbytes, "byte");
+  return ok;
+}
+
+static bool bench_tx_packet_n(uint32_t iterations)
+{
+  // a 16 voice chord
+  uint8_t chord[BENCH_EP_SIZE];
+  uint8_t sent[BENCH_EP_SIZE];
+  for (int idx = 0; idx < BENCH_PACKETS_PER_XFER; idx++)
+  {
+    chord[idx*4] = MIDI_CIN_NOTE_ON;
+    chord[idx*4+1] = 0x90;
+    chord[idx*4+2] = (uint8_t)(48 + idx);
+    chord[idx*4+3] = 100;
+  }
+  uint64_t write_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    uint64_t start = now_ns();
+    uint32_t nwritten = tuh_midi_packet_write_n(BENCH_DEV_ADDR, chord, BENCH_PACKETS_PER_XFER);
+    write_ns += now_ns() - start;
+    ok = nwritten == BENCH_PACKETS_PER_XFER && tuh_midi_stream_flush(BENCH_DEV_ADDR) == sizeof(chord);
+    ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent)) == sizeof(sent) && memcmp(sent, chord, sizeof(chord)) == 0;
+    // a full length transfer is followed by a zero length packet
+    ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, NULL, 0) == 0 && !mock_usbh_out_pending(BENCH_DEV_ADDR);
+    npackets += nwritten;
+  }
+  report("tuh_midi_packet_write_n", write_ns, npackets, "packet");
+  return ok;
+}
+
+static bool bench_tx_auto_flush(uint32_t iterations)
+{
+  static const uint8_t notes[] = {
+    MIDI_CIN_NOTE_ON, 0x90, 60, 100,
+    MIDI_CIN_NOTE_ON, 0x90, 64, 100,
+    MIDI_CIN_NOTE_ON, 0x90, 67, 100,
+  };
+  uint8_t sent[BENCH_EP_SIZE];
+  uint64_t write_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = tuh_midi_set_auto_flush(BENCH_DEV_ADDR, true);
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    // the first packet goes out right away; the other two are sent
+    // together when its transfer completes
+    uint64_t const start = now_ns();
+    for (int idx = 0; idx < 3; idx++)
+    {
+      ok = ok && tuh_midi_packet_write(BENCH_DEV_ADDR, notes + idx*4);
+    }
+    write_ns += now_ns() - start;
+    ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent)) == 4 && memcmp(sent, notes, 4) == 0;
+    ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent)) == 8 && memcmp(sent, notes + 4, 8) == 0;
+    ok = ok && !mock_usbh_out_pending(BENCH_DEV_ADDR);
+    npackets += 3;
+  }
+  report("tuh_midi_packet_write (auto)", write_ns, npackets, "packet");
+
+#if CFG_MIDI_HOST_TX_COALESCING
+  // with coalescing on too, a lone packet is held until tuh_midi_task()
+  // finds its hold time is up
+  ok = ok && tuh_midi_set_tx_coalescing(BENCH_DEV_ADDR, 1000) &&
+    tuh_midi_packet_write(BENCH_DEV_ADDR, notes) && !mock_usbh_out_pending(BENCH_DEV_ADDR);
+  mock_usbh_advance_us(999);
+  tuh_midi_task();
+  ok = ok && !mock_usbh_out_pending(BENCH_DEV_ADDR);
+  mock_usbh_advance_us(1);
+  tuh_midi_task();
+  ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent)) == 4 && memcmp(sent, notes, 4) == 0;
+  ok = tuh_midi_set_tx_coalescing(BENCH_DEV_ADDR, 0) && ok;
+#endif
+  ok = tuh_midi_set_auto_flush(BENCH_DEV_ADDR, false) && ok;
+  return ok;
+}
+
+#if CFG_MIDI_HOST_TX_COALESCING
+static bool bench_tx_coalescing(uint32_t iterations)
+{
+  static const uint8_t note[4] = {MIDI_CIN_NOTE_ON, 0x90, 60, 100};
+  static const uint8_t clock[4] = {MIDI_CIN_1BYTE_DATA, 0xF8, 0, 0};
+  uint8_t sent[BENCH_EP_SIZE];
+  uint64_t flush_ns = 0;
+  uint64_t npackets = 0;
+  bool ok = tuh_midi_set_tx_coalescing(BENCH_DEV_ADDR, 2000);
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    // a lone packet waits for the hold time to run out
+    ok = ok && tuh_midi_packet_write(BENCH_DEV_ADDR, note);
+    ok = ok && tuh_midi_stream_flush(BENCH_DEV_ADDR) == 0;
+    mock_usbh_advance_us(1000);
+    ok = ok && tuh_midi_stream_flush(BENCH_DEV_ADDR) == 0 && !mock_usbh_out_pending(BENCH_DEV_ADDR);
+    mock_usbh_advance_us(1000);
+    ok = ok && tuh_midi_stream_flush(BENCH_DEV_ADDR) == 4;
+    ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent)) == 4;
+
+    // a full transfer goes right away
+    for (int idx = 0; idx < BENCH_PACKETS_PER_XFER; idx++)
+    {
+      ok = ok && tuh_midi_packet_write(BENCH_DEV_ADDR, note);
+    }
+    uint64_t const start = now_ns();
+    ok = ok && tuh_midi_stream_flush(BENCH_DEV_ADDR) == BENCH_EP_SIZE;
+    flush_ns += now_ns() - start;
+    ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent)) == BENCH_EP_SIZE;
+    ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, NULL, 0) == 0;
+
+    // so does anything queued with a real-time packet
+    ok = ok && tuh_midi_packet_write(BENCH_DEV_ADDR, note) && tuh_midi_packet_write_priority(BENCH_DEV_ADDR, clock);
+    ok = ok && tuh_midi_stream_flush(BENCH_DEV_ADDR) == 8;
+    // the clock packet comes first unless the real-time queue is compiled out
+    ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent)) == 8;
+    ok = ok && (memcmp(sent, clock, 4) == 0 || memcmp(sent + 4, clock, 4) == 0);
+    ok = ok && !mock_usbh_out_pending(BENCH_DEV_ADDR);
+    npackets += BENCH_PACKETS_PER_XFER;
+  }
+  report("tuh_midi_stream_flush (held)", flush_ns, npackets, "packet");
+  ok = tuh_midi_set_tx_coalescing(BENCH_DEV_ADDR, 0) && ok;
+  return ok;
+}
+#endif
+
+#if CFG_MIDI_HOST_TX_SCHEDULE
+static bool bench_tx_schedule(uint32_t iterations)
+{
+  uint8_t sent[BENCH_EP_SIZE];
+  uint64_t write_ns = 0;
+  uint64_t npackets = 0;
+  uint32_t const depth = tuh_midi_packet_write_at_available(BENCH_DEV_ADDR);
+  bool ok = depth >= 8;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    // queue notes 60..67 due 100 us apart, latest first, with each
+    // pair of notes due at the same time
+    uint32_t const t0 = tuh_midi_time_us();
+    uint64_t const start = now_ns();
+    for (int idx = 7; idx >= 0; idx -= 2)
+    {
+      uint8_t const first[4] = {MIDI_CIN_NOTE_ON, 0x90, (uint8_t)(59 + idx), 100};
+      uint8_t const second[4] = {MIDI_CIN_NOTE_ON, 0x90, (uint8_t)(60 + idx), 100};
+      ok = ok && tuh_midi_packet_write_at(BENCH_DEV_ADDR, first, t0 + 100u * (uint32_t)idx);
+      ok = ok && tuh_midi_packet_write_at(BENCH_DEV_ADDR, second, t0 + 100u * (uint32_t)idx);
+    }
+    write_ns += now_ns() - start;
+
+    // nothing is sent until it is due
+    ok = ok && tuh_midi_stream_flush(BENCH_DEV_ADDR) == 0;
+    for (int idx = 0; ok && idx < 8; idx += 2)
+    {
+      mock_usbh_advance_us(idx == 0 ? 100 : 200);
+      ok = tuh_midi_stream_flush(BENCH_DEV_ADDR) == 8;
+      ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent)) == 8;
+      ok = ok && sent[2] == 60 + idx && sent[6] == 61 + idx;
+    }
+    ok = ok && tuh_midi_packet_write_at_available(BENCH_DEV_ADDR) == depth;
+    npackets += 8;
+  }
+  report("tuh_midi_packet_write_at", write_ns, npackets, "packet");
+
+  // received data also sends due packets without a flush
+  static const uint8_t note[4] = {MIDI_CIN_NOTE_ON, 0x90, 72, 100};
+  uint8_t xfer[BENCH_EP_SIZE];
+  uint8_t packets[BENCH_EP_SIZE];
+  fill_cc_xfer(xfer, 0);
+  ok = ok && tuh_midi_packet_write_at(BENCH_DEV_ADDR, note, tuh_midi_time_us() + 100);
+  ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, sizeof(xfer)) && !mock_usbh_out_pending(BENCH_DEV_ADDR);
+  mock_usbh_advance_us(100);
+  ok = ok && mock_usbh_in_xfer(BENCH_DEV_ADDR, xfer, sizeof(xfer));
+  ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent)) == 4 && memcmp(sent, note, 4) == 0;
+  ok = ok && tuh_midi_packet_read_n(BENCH_DEV_ADDR, packets, BENCH_PACKETS_PER_XFER) == BENCH_PACKETS_PER_XFER;
+  ok = ok && tuh_midi_packet_read_n(BENCH_DEV_ADDR, packets, BENCH_PACKETS_PER_XFER) == BENCH_PACKETS_PER_XFER;
+
+  // and so does tuh_midi_task() on an idle bus
+  ok = ok && tuh_midi_packet_write_at(BENCH_DEV_ADDR, note, tuh_midi_time_us() + 100);
+  tuh_midi_task();
+  ok = ok && !mock_usbh_out_pending(BENCH_DEV_ADDR);
+  mock_usbh_advance_us(100);
+  tuh_midi_task();
+  ok = ok && mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent)) == 4 && memcmp(sent, note, 4) == 0;
+  return ok;
+}
+#endif
+
+#if CFG_MIDI_HOST_SYSEX_SEND
+static bool sysex_sent;
+
+static void sysex_done(uint8_t dev_addr, uint8_t const* buffer, bool complete)
+{
+  (void) dev_addr;
+  (void) buffer;
+  sysex_sent = complete;
+}
+
+static bool bench_tx_sysex_send(uint32_t iterations)
+{
+  // a 1000 byte sample dump style message
+  static uint8_t msg[1000];
+  msg[0] = 0xF0;
+  for (size_t idx = 1; idx < sizeof(msg) - 1; idx++)
+  {
+    msg[idx] = (uint8_t)(idx & 0x7f);
+  }
+  msg[sizeof(msg) - 1] = 0xF7;
+  uint8_t sent[BENCH_EP_SIZE];
+  uint8_t received[sizeof(msg)];
+  uint64_t send_ns = 0;
+  uint64_t nbytes = 0;
+  bool ok = true;
+  for (uint32_t iter = 0; iter < iterations && ok; iter++)
+  {
+    sysex_sent = false;
+    uint32_t nreceived = 0;
+    uint64_t start = now_ns();
+    ok = tuh_midi_sysex_send(BENCH_DEV_ADDR, 0, msg, sizeof(msg), sysex_done);
+    send_ns += now_ns() - start;
+    while (ok && mock_usbh_out_pending(BENCH_DEV_ADDR))
+    {
+      // completing the transfer makes the driver pack the next one
+      start = now_ns();
+      uint16_t const xferred = mock_usbh_out_xfer(BENCH_DEV_ADDR, sent, sizeof(sent));
+      send_ns += now_ns() - start;
+      for (uint16_t idx = 0; ok && idx < xferred; idx += 4)
+      {
+        uint8_t const cin = sent[idx] & 0xf;
+        uint8_t const len = cin == MIDI_CIN_SYSEX_START ? 3 : (uint8_t)(cin - MIDI_CIN_SYSEX_END_1BYTE + 1);
+        ok = (cin >= MIDI_CIN_SYSEX_START && cin <= MIDI_CIN_SYSEX_END_3BYTE) && nreceived + len <= sizeof(received);
+        if (ok)
+        {
+          memcpy(received + nreceived, sent + idx + 1, len);
+          nreceived += len;
+        }
+      }
+    }
+    ok = ok && sysex_sent && !tuh_midi_sysex_busy(BENCH_DEV_ADDR);
+    ok = ok && nreceived == sizeof(msg) && memcmp(received, msg, sizeof(msg)) == 0;
+    nbytes += sizeof(msg);
+  }
+  report("tuh_midi_sysex_send", send_ns, nbytes, "byte");
+
+  // a status byte inside the message is refused, and nothing is sent
+  msg[sizeof(msg) / 2] = 0xF6;
+  ok = ok && !tuh_midi_sysex_send(BENCH_DEV_ADDR, 0, msg, sizeof(msg), sysex_done) &&
+    !tuh_midi_sysex_busy(BENCH_DEV_ADDR) && !mock_usbh_out_pending(BENCH_DEV_ADDR);
+  return ok;
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+  uint32_t iterations = 100000;
+  if (argc > 1)
+  {
+    iterations = (uint32_t)strtoul(argv[1], NULL, 0);
+  }
+
+  if (!midih_init() || !mock_usbh_mount(BENCH_DEV_ADDR, BENCH_NUM_CABLES, BENCH_EP_SIZE) ||
+    !mock_usbh_mount(BENCH_MULTI_ADDR, BENCH_MULTI_CABLES, BENCH_EP_SIZE))
+  {
+    printf("failed to mount the mock MIDI devices\r\n");
+    return 1;
+  }
+  printf("usb_midi_host bench: %lu iterations\r\n", (unsigned long)iterations);
+  // the TX scenarios flush explicitly and send right away, and the RX
+  // scenarios let the RX FIFO overflow, unless they turn on auto-flush,
+  // coalescing or RX flow control themselves
+  for (uint8_t dev_addr = BENCH_DEV_ADDR; dev_addr <= BENCH_MULTI_ADDR; dev_addr++)
+  {
+    tuh_midi_set_auto_flush(dev_addr, false);
+#if CFG_MIDI_HOST_TX_COALESCING
+    tuh_midi_set_tx_coalescing(dev_addr, 0);
+#endif
+    tuh_midi_set_rx_flow_control(dev_addr, false, 0);
+  }
+
+  int failures = 0;
+  struct {
+    const char* name;
+    bool (*run)(uint32_t iterations);
+  } const benches[] = {
+    {"rx packet", bench_rx_packet},
+    {"rx packet_n", bench_rx_packet_n},
+    {"rx sparse", bench_rx_sparse},
+    {"rx packet peek", bench_rx_packet_peek},
+    {"rx stream", bench_rx_stream},
+    {"rx event", bench_rx_event},
+    {"rx real-time callback", bench_rx_rt_cb},
+    {"rx overflow drop newest", bench_rx_overflow_newest},
+    {"rx overflow drop oldest", bench_rx_overflow_oldest},
+    {"rx flow control", bench_rx_flow_control},
+#if !CFG_MIDI_HOST_SYSEX_RX
+    // tuh_midi_sysex_cb() takes SysEx messages out before they are queued
+    {"rx overflow drop sysex", bench_rx_overflow_sysex},
+#endif
+    {"rx ping-pong", bench_rx_ping_pong},
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+    {"rx cable queues", bench_rx_cable_queues},
+#endif
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+    {"rx stream timestamps", bench_rx_stream_ts},
+#endif
+#if CFG_MIDI_HOST_SYSEX_RX
+    {"rx sysex reassembly", bench_rx_sysex},
+#endif
+#if CFG_MIDI_HOST_RX_FILTER
+    {"rx filter", bench_rx_filter},
+#endif
+    {"tx stream", bench_tx_stream},
+    {"tx stream encoder", bench_tx_stream_encoder},
+    {"tx packet_n", bench_tx_packet_n},
+    {"tx priority", bench_tx_priority},
+    {"tx staging", bench_tx_staging},
+    {"tx auto-flush", bench_tx_auto_flush},
+#if CFG_MIDI_HOST_TX_COALESCING
+    {"tx coalescing", bench_tx_coalescing},
+#endif
+#if CFG_MIDI_HOST_TX_SCHEDULE
+    {"tx schedule", bench_tx_schedule},
+#endif
+#if CFG_MIDI_HOST_SYSEX_SEND
+    {"tx sysex send", bench_tx_sysex_send},
+#endif
+  };
+  for (size_t idx = 0; idx < TU_ARRAY_SIZE(benches); idx++)
+  {
+    if (!benches[idx].run(iterations))
+    {
+      printf("%s: data mismatch\r\n", benches[idx].name);
+      ++failures;
+    }
+  }
+
+#if CFG_MIDI_HOST_STATS
+  tuh_midi_stats_t stats;
+  if (tuh_midi_get_stats(BENCH_DEV_ADDR, &stats))
+  {
+    printf("stats: rx %lu xfers %lu packets %lu zero %lu dropped %lu discarded, tx %lu xfers %lu bytes %lu zlps\r\n",
+      (unsigned long)stats.rx_xfers, (unsigned long)stats.rx_packets, (unsigned long)stats.rx_zero_packets,
+      (unsigned long)stats.rx_dropped_packets, (unsigned long)stats.rx_discarded_packets,
+      (unsigned long)stats.tx_xfers, (unsigned long)stats.tx_bytes,
+      (unsigned long)stats.tx_zlps);
+  }
+#endif
+
+  mock_usbh_unmount(BENCH_MULTI_ADDR);
+  mock_usbh_unmount(BENCH_DEV_ADDR);
+  midih_deinit();
+#if CFG_MIDI_HOST_TRACE
+  // save the end of the trace for midih_trace_decode
+  FILE* dump = fopen("usb_midi_host_trace.bin", "wb");
+  if (dump)
+  {
+    tuh_midi_trace_record_t records[64];
+    uint32_t nrecords;
+    while ((nrecords = tuh_midi_trace_read(records, TU_ARRAY_SIZE(records))) != 0)
+    {
+      fwrite(records, sizeof(records[0]), nrecords, dump);
+    }
+    fclose(dump);
+    printf("trace saved to usb_midi_host_trace.bin\r\n");
+  }
+#endif
+  return failures ? 1 : 0;
+}
@@ -50,6 +50,62 @@
 #ifndef CFG_TUH_MIDI_EP_BUFSIZE
   #define CFG_TUH_MIDI_EP_BUFSIZE USBH_EPSIZE_BULK_MAX
 #endif
+// Maximum number of MIDI devices that can be mounted at the same time.
+// Buffers are reserved for this many devices and are handed to a device
+// when it is mounted, so this can be less than CFG_TUH_DEVICE_MAX when
+// hubs and other devices use some of the device addresses.
+#ifndef CFG_TUH_MIDI_DEVICE_MAX
+  #define CFG_TUH_MIDI_DEVICE_MAX CFG_TUH_DEVICE_MAX
+#endif
+// Size of the high priority TX FIFO for real-time messages. Set to 0 to
+// send real-time messages through the normal TX FIFO.
+#ifndef CFG_TUH_MIDI_TX_RT_BUFSIZE
+  #define CFG_TUH_MIDI_TX_RT_BUFSIZE 16
+#endif
+// Update the statistics counters that tuh_midi_get_stats() reports
+#if CFG_MIDI_HOST_STATS
+  #define MIDIH_STATS_ADD(midi, field, n) ((midi)->stats.field += (uint32_t)(n))
+  #define MIDIH_STATS_MAX(midi, field, n) do { if ((uint32_t)(n) > (midi)->stats.field) (midi)->stats.field = (uint32_t)(n); } while (0)
+#else
+  #define MIDIH_STATS_ADD(midi, field, n)
+  #define MIDIH_STATS_MAX(midi, field, n)
+#endif
+// Number of packets tuh_midi_packet_write_at() can hold per device
+#ifndef CFG_TUH_MIDI_TX_SCHED_DEPTH
+  #define CFG_TUH_MIDI_TX_SCHED_DEPTH 32
+#endif
+// Size of each buffer in the SysEx reassembly arena; longer messages are
+// truncated to this many bytes
+#ifndef CFG_TUH_MIDI_SYSEX_BUFSIZE
+  #define CFG_TUH_MIDI_SYSEX_BUFSIZE 256
+#endif
+// Number of buffers in the SysEx reassembly arena, which is how many
+// messages all devices and cables together can be sending at once
+#ifndef CFG_TUH_MIDI_SYSEX_BUFFERS
+  #define CFG_TUH_MIDI_SYSEX_BUFFERS 2
+#endif
+// Number of records the trace ring holds. Must be a power of 2.
+#ifndef CFG_TUH_MIDI_TRACE_DEPTH
+  #define CFG_TUH_MIDI_TRACE_DEPTH 256
+#endif
+// Record a driver event in the trace ring
+#if CFG_MIDI_HOST_TRACE
+  #define MIDIH_TRACE(event, dev_addr, arg) midih_trace(TUH_MIDI_TRACE_##event, (dev_addr), (arg))
+#else
+  #define MIDIH_TRACE(event, dev_addr, arg)
+#endif
+// Free running microsecond clock. It may wrap. Only the features that
+// need a clock use it; see MIDI_HOST_HAS_CLOCK.
+#if MIDI_HOST_HAS_CLOCK && !defined(CFG_TUH_MIDI_TIME_US)
+  #if CFG_TUSB_MCU == OPT_MCU_RP2040
+    #include "pico/time.h"
+    #define CFG_TUH_MIDI_TIME_US() time_us_32()
+  #else
+    // only millisecond resolution
+    uint32_t tusb_time_millis_api(void);
+    #define CFG_TUH_MIDI_TIME_US() (tusb_time_millis_api() * 1000u)
+  #endif
+#endif
 
 
 #define MIDI_MAX_DATA_VAL 0x7f
@@ -76,6 +132,36 @@ typedef struct
   uint8_t total;
 }midi_stream_t;
 
+// A packet waiting in the TX schedule for its due time. seq keeps
+// packets that are due at the same time in the order they were queued.
+typedef struct
+{
+  uint32_t due_us;
+  uint32_t seq;
+  uint8_t packet[4];
+}midih_sched_event_t;
+
+// The buffers one mounted MIDI device uses. midih_init() reserves
+// CFG_TUH_MIDI_DEVICE_MAX of these; midih_open() binds one to a device
+// and midih_close() returns it.
+typedef struct
+{
+  uint8_t *rx_ff_buf;
+  uint8_t *tx_ff_buf;
+  midi_stream_t *stream_write;
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  tu_fifo_t *rx_cable_ff;
+#endif
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+  // The arrival time of the packet in each 4-byte slot of rx_ff_buf
+  uint32_t *rx_ts_buf;
+#endif
+#if CFG_MIDI_HOST_TX_SCHEDULE
+  midih_sched_event_t *tx_sched;
+#endif
+  bool in_use;
+}midih_buffers_t;
+
 typedef struct
 {
   uint8_t dev_addr;
@@ -90,28 +176,106 @@ typedef struct
   uint8_t num_cables_tx;  // OUT endpoint CS descriptor bNumEmbMIDIJack value
 
   // For Stream read()/write() API
-  // Messages are always 4 bytes long, queue them for reading and writing so the
-  // callers can use the Stream interface with single-byte read/write calls.
+  // Messages are always 4 bytes long, queue them for writing so the
+  // callers can use the Stream interface with single-byte write calls.
   midi_stream_t *stream_write;
-  midi_stream_t stream_read;
+  // bit i is set if received MIDI_STATUS_SYSEX_START but not MIDI_STATUS_SYSEX_END on cable i
+  uint16_t cable_sysex_in_progress;
 
   /*------------- From this point, data is not cleared by bus reset -------------*/
   // Endpoint FIFOs
   tu_fifo_t rx_ff;
   tu_fifo_t tx_ff;
- 
+#if CFG_TUH_MIDI_TX_RT_BUFSIZE
+  // write_flush() always empties this FIFO into an OUT buffer before tx_ff
+  tu_fifo_t tx_rt_ff;
+  uint8_t tx_rt_ff_buf[CFG_TUH_MIDI_TX_RT_BUFSIZE];
+#endif
 
-  uint8_t *rx_ff_buf;
-  uint8_t *tx_ff_buf;
+  // NULL unless a MIDI device is mounted; rx_ff and tx_ff have no storage then
+  midih_buffers_t *bufs;
+
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  // One RX FIFO per virtual cable carved out of bufs->rx_ff_buf; rx_ff is not used
+  tu_fifo_t *rx_cable_ff;
+  uint8_t rx_next_cable;  // the cable queue get_rx_fifo() checks first
+  tu_fifo_t *rx_peek_ff;  // the queue tuh_midi_packet_peek() last returned packets from
+#endif
 
   #if CFG_FIFO_MUTEX
   osal_mutex_def_t rx_ff_mutex;
+  #if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  osal_mutex_t rx_mutex;  // shared by all the cable queues
+  #endif
   osal_mutex_def_t tx_ff_mutex;
+  #if CFG_TUH_MIDI_TX_RT_BUFSIZE
+  osal_mutex_def_t tx_rt_ff_mutex;
+  #endif
   #endif
 
-  // Endpoint Transfer buffer
-  CFG_TUSB_MEM_ALIGN uint8_t epout_buf[CFG_TUH_MIDI_EP_BUFSIZE];
-  CFG_TUSB_MEM_ALIGN uint8_t epin_buf[CFG_TUH_MIDI_EP_BUFSIZE];
+  // Endpoint Transfer buffers. While an OUT transfer is on the bus from
+  // one OUT buffer, write_flush() packs the next transfer into the other
+  CFG_TUSB_MEM_ALIGN uint8_t epout_buf[2][CFG_TUH_MIDI_EP_BUFSIZE];
+  uint8_t epout_idx;     // the OUT buffer the next OUT transfer sends
+  bool auto_flush;       // the write functions call write_flush()
+  bool tx_holding;       // TX data is queued and tx_hold_start is valid
+  uint32_t tx_hold_us;   // TX coalescing hold time; 0 to send right away
+  bool tx_flush_held;    // a flush held TX data back; tx_service() sends it when the hold time is up
+  uint32_t tx_hold_start; // CFG_TUH_MIDI_TIME_US() when the held data started to queue
+  tuh_midi_rx_overflow_t rx_overflow; // what to drop when an RX FIFO is full
+  // bit i is set while a SysEx message is arriving on cable i. This follows
+  // the same status byte rules as cable_sysex_in_progress, but as packets
+  // arrive instead of as the application reads them; see rx_sysex_track()
+  uint16_t rx_sysex_active;
+  // bit i is set while TUH_MIDI_RX_DROP_SYSEX drops the rest of a SysEx message on cable i
+  uint16_t rx_sysex_dropping;
+#if CFG_MIDI_HOST_RX_FILTER
+  // per cable masks of the TUH_MIDI_FILTER_ message types and the channels
+  // to drop before the packets are queued
+  uint32_t rx_filter_types[CFG_TUH_MAX_CABLES];
+  uint16_t rx_filter_channels[CFG_TUH_MAX_CABLES];
+  uint16_t rx_filter_sysex;  // bit i is set while dropping a SysEx message on cable i
+  bool rx_filter_on;         // some cable has a filter
+#endif
+#if CFG_MIDI_HOST_SYSEX_RX
+  // the arena buffer assembling each cable's SysEx message, MIDIH_SYSEX_NO_ROOM
+  // if none was free, or MIDIH_SYSEX_NO_BUF while no message arrives on the cable
+  uint8_t sysex_rx_buf[CFG_TUH_MAX_CABLES];
+#endif
+  bool rx_flow_control;     // stop IN polling instead of dropping packets
+  bool rx_paused;           // IN polling stopped until the RX FIFO(s) drain
+  uint16_t rx_resume_level; // restart IN polling when no RX FIFO holds more bytes
+#if CFG_MIDI_HOST_STATS
+  tuh_midi_stats_t stats;
+#endif
+#if CFG_MIDI_HOST_TX_SCHEDULE
+  // min-heap of packets ordered by due time; the next one due is tx_sched[0]
+  midih_sched_event_t *tx_sched;
+  uint16_t tx_sched_count;
+  uint32_t tx_sched_seq;
+#endif
+#if CFG_MIDI_HOST_SYSEX_SEND
+  // the message tuh_midi_sysex_send() is sending, or NULL
+  uint8_t const *sysex_buf;
+  uint32_t sysex_len;
+  uint32_t sysex_pos;        // bytes of sysex_buf packed into OUT buffers so far
+  uint16_t sysex_ahead;      // bytes in tx_ff that were queued before the SysEx message
+  uint8_t sysex_cable;
+  bool sysex_end_staged;     // epout_buf[epout_idx] holds the end of the SysEx message
+  bool sysex_end_sent;       // the OUT transfer on the bus holds the end of the SysEx message
+  tuh_midi_sysex_done_cb_t sysex_done_cb;
+#endif
+  uint16_t epout_staged; // number of bytes packed into epout_buf[epout_idx]
+  bool epout_rt_staged;  // epout_buf[epout_idx] holds real-time packets
+  // Two IN buffers so midih_xfer_cb() can queue the next IN transfer on
+  // one before it processes the packets that arrived in the other. They
+  // are also viewed as 32-bit words so midih_xfer_cb() can test and move
+  // a whole MIDI packet with one load and store
+  union {
+    CFG_TUSB_MEM_ALIGN uint8_t epin_buf[2][CFG_TUH_MIDI_EP_BUFSIZE];
+    uint32_t epin_words[2][CFG_TUH_MIDI_EP_BUFSIZE/4];
+  };
+  uint8_t epin_idx; // the IN buffer the pending IN transfer fills
 
   bool configured;
   // Track the transfer result in the xfer_cb function
@@ -146,177 +310,1062 @@ typedef struct
 
 static midih_interface_t _midi_host[CFG_TUH_DEVICE_MAX];
 
+static midih_buffers_t midih_pool[CFG_TUH_MIDI_DEVICE_MAX];
+
+#if CFG_MIDI_HOST_STATIC_ALLOC
+// Buffers for every pool entry, sized at compile time so the linker
+// accounts for all of the driver's RAM
+static uint8_t midih_rx_ff_bufs[CFG_TUH_MIDI_DEVICE_MAX][CFG_TUH_MIDI_RX_BUFSIZE];
+static uint8_t midih_tx_ff_bufs[CFG_TUH_MIDI_DEVICE_MAX][CFG_TUH_MIDI_TX_BUFSIZE];
+static midi_stream_t midih_stream_write_bufs[CFG_TUH_MIDI_DEVICE_MAX][CFG_TUH_MAX_CABLES];
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+static uint32_t midih_rx_ts_bufs[CFG_TUH_MIDI_DEVICE_MAX][CFG_TUH_MIDI_RX_BUFSIZE/4];
+#endif
+#if CFG_MIDI_HOST_TX_SCHEDULE
+static midih_sched_event_t midih_tx_sched_bufs[CFG_TUH_MIDI_DEVICE_MAX][CFG_TUH_MIDI_TX_SCHED_DEPTH];
+#endif
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+static tu_fifo_t midih_rx_cable_ff_bufs[CFG_TUH_MIDI_DEVICE_MAX][CFG_TUH_MAX_CABLES];
+#endif
+#else
+static struct midih_allocator_s {
+  void* (*alloc)(size_t size);
+  void (*free)(void* ptr);
+} midih_allocator = {malloc, free};
+#endif
+
 static midih_interface_t *get_midi_host(uint8_t dev_addr)
 {
   TU_VERIFY(dev_addr >0 && dev_addr <= CFG_TUH_DEVICE_MAX);
   return (_midi_host + dev_addr - 1);
 }
 
+#if CFG_MIDI_HOST_TRACE
+TU_VERIFY_STATIC((CFG_TUH_MIDI_TRACE_DEPTH & (CFG_TUH_MIDI_TRACE_DEPTH - 1)) == 0, "CFG_TUH_MIDI_TRACE_DEPTH must be a power of 2");
+TU_VERIFY_STATIC(sizeof(tuh_midi_trace_record_t) == 8, "trace records must be 8 bytes");
+
+// The head and tail count records written and read since the last clear;
+// they wrap, and only their difference matters. The newest records
+// overwrite the oldest ones when nobody reads the ring.
+static struct
+{
+  tuh_midi_trace_record_t records[CFG_TUH_MIDI_TRACE_DEPTH];
+  uint32_t head;
+  uint32_t tail;
+} midih_trace_ring;
+
+static void midih_trace(tuh_midi_trace_event_t event, uint8_t dev_addr, uint32_t arg)
+{
+  tuh_midi_trace_record_t* rec = &midih_trace_ring.records[midih_trace_ring.head & (CFG_TUH_MIDI_TRACE_DEPTH - 1)];
+  rec->time_us = CFG_TUH_MIDI_TIME_US();
+  rec->event = (uint8_t)event;
+  rec->dev_addr = dev_addr;
+  rec->arg = arg > UINT16_MAX ? UINT16_MAX : (uint16_t)arg;
+  ++midih_trace_ring.head;
+}
+#endif
+
 //------------- Internal prototypes -------------//
 static uint32_t write_flush(uint8_t dev_addr, midih_interface_t* midi);
-
-static void midih_freeall(void)
+static uint32_t tx_fifo_count(midih_interface_t* midi);
+static bool tx_sched_service(midih_interface_t* midi);
+static void tx_service(uint8_t dev_addr, midih_interface_t* midi);
+static uint8_t midi_packet_stream_bytes(uint8_t const* packet, uint16_t* p_sysex_in_progress);
+
+// Remove the all-zero packets some devices use as filler from the
+// npackets MIDI packets stored in words and slide the remaining packets
+// down to close the gaps. Return the number of packets that remain.
+static uint32_t compact_rx_packets(uint32_t* words, uint32_t npackets)
 {
-  // free memory allocated by midih_init()
-  for (int inst = 0; inst < CFG_TUH_DEVICE_MAX; inst++)
+  uint32_t idx = 0;
+  // Fast path for dense data: packets before the first zero packet are
+  // already in the right place, so skip them 4 at a time.
+  while (idx + 4 <= npackets && words[idx] && words[idx+1] && words[idx+2] && words[idx+3])
   {
-    midih_interface_t *p_midi_host = &_midi_host[inst];
-    if (p_midi_host->rx_ff_buf != NULL)
+    idx += 4;
+  }
+  uint32_t nkept = idx;
+  for (; idx < npackets; idx++)
+  {
+    uint32_t const packet = words[idx];
+    if (packet != 0)
     {
-      free (p_midi_host->rx_ff_buf);
-      p_midi_host->rx_ff_buf = NULL;
+      words[nkept++] = packet;
     }
-    if (p_midi_host->tx_ff_buf != NULL)
+  }
+  return nkept;
+}
+
+// Flags rx_sysex_track() returns for a received packet
+#define MIDIH_RX_SYSEX        0x01 // the packet is part of a SysEx message
+#define MIDIH_RX_SYSEX_START  0x02 // it holds the message's 0xF0
+#define MIDIH_RX_SYSEX_END    0x04 // it holds the message's 0xF7
+#define MIDIH_RX_SYSEX_CUT    0x08 // it ended the cable's previous SysEx message before its 0xF7
+
+// Follow the SysEx state of the packet's cable in rx_sysex_active and
+// classify the packet. Like tuh_midi_stream_read(), go by the status byte,
+// not the CIN: 0xF0 starts a message, data bytes and 0xF7 continue it, any
+// other status except real-time ends it. Store the number of MIDI stream
+// bytes the packet holds in *p_nbytes.
+static uint8_t rx_sysex_track(midih_interface_t *p_midi_host, uint8_t const* packet, uint8_t *p_nbytes)
+{
+  uint16_t const cable_mask = (uint16_t)(1u << (packet[0] >> 4));
+  uint8_t const status = packet[1];
+  bool const was_active = (p_midi_host->rx_sysex_active & cable_mask) != 0;
+  *p_nbytes = midi_packet_stream_bytes(packet, &p_midi_host->rx_sysex_active);
+  uint8_t flags;
+  if (status == MIDI_STATUS_SYSEX_START)
+  {
+    flags = was_active ? MIDIH_RX_SYSEX | MIDIH_RX_SYSEX_START | MIDIH_RX_SYSEX_CUT : MIDIH_RX_SYSEX | MIDIH_RX_SYSEX_START;
+  }
+  else if (!was_active || status >= MIDI_STATUS_SYSREAL_TIMING_CLOCK)
+  {
+    return 0;
+  }
+  else if (status <= MIDI_MAX_DATA_VAL || status == MIDI_STATUS_SYSEX_END)
+  {
+    flags = MIDIH_RX_SYSEX;
+  }
+  else
+  {
+    return MIDIH_RX_SYSEX_CUT;
+  }
+  if (!(p_midi_host->rx_sysex_active & cable_mask))
+  {
+    flags |= MIDIH_RX_SYSEX_END;
+  }
+  return flags;
+}
+
+#if CFG_MIDI_HOST_RX_FILTER
+// Return true if the filter tuh_midi_set_rx_filter() set for the packet's
+// cable drops it. sysex holds the rx_sysex_track() flags of the packet, so
+// a filtered SysEx message loses all of its packets.
+static bool rx_filter_drop(midih_interface_t *p_midi_host, uint8_t const* packet, uint8_t sysex)
+{
+  uint8_t const cable = packet[0] >> 4;
+  uint16_t const cable_mask = (uint16_t)(1u << cable);
+  uint8_t const status = packet[1];
+  uint32_t const types = p_midi_host->rx_filter_types[cable];
+  bool drop;
+  if (sysex & (MIDIH_RX_SYSEX_START | MIDIH_RX_SYSEX_CUT))
+  {
+    p_midi_host->rx_filter_sysex &= (uint16_t)~cable_mask;
+  }
+  if (sysex & MIDIH_RX_SYSEX)
+  {
+    if ((sysex & MIDIH_RX_SYSEX_START) && (types & TUH_MIDI_FILTER_SYSEX))
     {
-      free (p_midi_host->tx_ff_buf);
-      p_midi_host->tx_ff_buf = NULL;
+      p_midi_host->rx_filter_sysex |= cable_mask;
     }
-    if (p_midi_host->stream_write != NULL)
+    drop = (p_midi_host->rx_filter_sysex & cable_mask) != 0;
+    if (sysex & MIDIH_RX_SYSEX_END)
     {
-      free(p_midi_host->stream_write);
-      p_midi_host->stream_write = NULL;
+      p_midi_host->rx_filter_sysex &= (uint16_t)~cable_mask;
     }
+    MIDIH_STATS_ADD(p_midi_host, rx_filtered_sysex, drop);
+  }
+  else if (status <= MIDI_MAX_DATA_VAL)
+  {
+    drop = false; // data outside a message; the readers skip it
+  }
+  else if (status >= MIDI_STATUS_SYSREAL_TIMING_CLOCK)
+  {
+    drop = (types & TUH_MIDI_FILTER_STATUS(status)) != 0;
+    MIDIH_STATS_ADD(p_midi_host, rx_filtered_realtime, drop);
+  }
+  else if (status < MIDI_STATUS_SYSEX_START)
+  {
+    drop = (types & TUH_MIDI_FILTER_STATUS(status)) ||
+      (p_midi_host->rx_filter_channels[cable] & (1u << (status & 0x0F)));
+    MIDIH_STATS_ADD(p_midi_host, rx_filtered_channel, drop);
   }
+  else
+  {
+    drop = (types & TUH_MIDI_FILTER_STATUS(status)) != 0;
+    MIDIH_STATS_ADD(p_midi_host, rx_filtered_common, drop);
+  }
+  return drop;
 }
+#endif
 
-//--------------------------------------------------------------------+
-// USBH API
-//--------------------------------------------------------------------+
-void tuh_midih_define_limits(size_t midi_rx_buffer_bytes, size_t midi_tx_buffer_bytes, uint8_t max_cables)
+#if CFG_MIDI_HOST_SYSEX_RX
+#define MIDIH_SYSEX_NO_BUF  0xff // no SysEx message is arriving on the cable
+#define MIDIH_SYSEX_NO_ROOM 0xfe // one is, but no arena buffer was free for it
+TU_VERIFY_STATIC(CFG_TUH_MIDI_SYSEX_BUFFERS < MIDIH_SYSEX_NO_ROOM, "CFG_TUH_MIDI_SYSEX_BUFFERS must be less than 254 so buffer indexes fit beside the sentinels");
+
+typedef struct
 {
-  // prevent memory leak in case midih_init() was called before this function
-  midih_freeall();
-  midih_limits.midi_rx_buf = midi_rx_buffer_bytes;
-  midih_limits.midi_tx_buf = midi_tx_buffer_bytes;
-  midih_limits.max_cables = max_cables;
+  uint8_t data[CFG_TUH_MIDI_SYSEX_BUFSIZE];
+  uint32_t len;
+  bool truncated;
+  bool in_use;
+} midih_sysex_rx_buf_t;
+
+// Shared by all devices; a message takes a buffer when its 0xF0 arrives
+static midih_sysex_rx_buf_t midih_sysex_arena[CFG_TUH_MIDI_SYSEX_BUFFERS];
+
+// Deliver the SysEx message assembled for cable and give its buffer back
+// to the arena. A message that had no buffer is reported with no data.
+static void sysex_rx_finish(uint8_t dev_addr, midih_interface_t *p_midi_host, uint8_t cable, bool truncated)
+{
+  uint8_t const idx = p_midi_host->sysex_rx_buf[cable];
+  p_midi_host->sysex_rx_buf[cable] = MIDIH_SYSEX_NO_BUF;
+  if (idx == MIDIH_SYSEX_NO_ROOM)
+  {
+    MIDIH_STATS_ADD(p_midi_host, rx_sysex_truncated, 1);
+    tuh_midi_sysex_cb(dev_addr, cable, NULL, 0, true);
+    return;
+  }
+  midih_sysex_rx_buf_t *buf = &midih_sysex_arena[idx];
+  truncated |= buf->truncated;
+  if (truncated)
+  {
+    MIDIH_STATS_ADD(p_midi_host, rx_sysex_truncated, 1);
+  }
+  tuh_midi_sysex_cb(dev_addr, cable, buf->data, buf->len, truncated);
+  buf->in_use = false;
 }
 
-bool midih_init(void)
+// Free the device's SysEx buffers without delivering the messages in them
+static void sysex_rx_release(midih_interface_t *p_midi_host)
 {
-  tu_memclr(&_midi_host, sizeof(_midi_host));
-  // config fifos
-  for (int inst = 0; inst < CFG_TUH_DEVICE_MAX; inst++)
+  for (uint8_t cable = 0; cable < CFG_TUH_MAX_CABLES; cable++)
   {
-    midih_interface_t *p_midi_host = &_midi_host[inst];
-    p_midi_host->rx_ff_buf = malloc(midih_limits.midi_rx_buf);
-    p_midi_host->tx_ff_buf = malloc(midih_limits.midi_tx_buf);
-    p_midi_host->stream_write = malloc(midih_limits.max_cables * sizeof(midi_stream_t));
-    TU_ASSERT((p_midi_host->rx_ff_buf != NULL && p_midi_host->tx_ff_buf != NULL && p_midi_host->stream_write != NULL), 0);
-    tu_memclr(p_midi_host->stream_write, sizeof(*(p_midi_host->stream_write))*midih_limits.max_cables);
-    tu_fifo_config(&p_midi_host->rx_ff, p_midi_host->rx_ff_buf, midih_limits.midi_rx_buf, 1, false); // true, true
-    tu_fifo_config(&p_midi_host->tx_ff, p_midi_host->tx_ff_buf, midih_limits.midi_tx_buf, 1, false); // OBVS.
-
-  #if CFG_FIFO_MUTEX
-    tu_fifo_config_mutex(&p_midi_host->rx_ff, NULL, osal_mutex_create(&p_midi_host->rx_ff_mutex));
-    tu_fifo_config_mutex(&p_midi_host->tx_ff, osal_mutex_create(&p_midi_host->tx_ff_mutex), NULL);
-  #endif
+    if (p_midi_host->sysex_rx_buf[cable] < CFG_TUH_MIDI_SYSEX_BUFFERS)
+    {
+      midih_sysex_arena[p_midi_host->sysex_rx_buf[cable]].in_use = false;
+    }
+    p_midi_host->sysex_rx_buf[cable] = MIDIH_SYSEX_NO_BUF;
   }
-  return true;
 }
 
-bool midih_deinit()
+// Add the nbytes MIDI stream bytes of a packet rx_sysex_track() flagged as
+// SysEx to the message assembled for its cable. The message takes an arena
+// buffer at its 0xF0 and goes to tuh_midi_sysex_cb() at its 0xF7.
+static void sysex_rx_add(uint8_t dev_addr, midih_interface_t *p_midi_host, uint8_t const* packet, uint8_t nbytes, uint8_t sysex)
 {
-  midih_freeall();
-  return true;
+  uint8_t const cable = packet[0] >> 4;
+  if (sysex & MIDIH_RX_SYSEX_START)
+  {
+    p_midi_host->sysex_rx_buf[cable] = MIDIH_SYSEX_NO_ROOM;
+    for (uint8_t buf_idx = 0; buf_idx < CFG_TUH_MIDI_SYSEX_BUFFERS; buf_idx++)
+    {
+      if (!midih_sysex_arena[buf_idx].in_use)
+      {
+        midih_sysex_arena[buf_idx].in_use = true;
+        midih_sysex_arena[buf_idx].len = 0;
+        midih_sysex_arena[buf_idx].truncated = false;
+        p_midi_host->sysex_rx_buf[cable] = buf_idx;
+        break;
+      }
+    }
+  }
+  else if (p_midi_host->sysex_rx_buf[cable] == MIDIH_SYSEX_NO_BUF)
+  {
+    return; // the rest of a message whose start was not assembled
+  }
+  uint8_t const idx_buf = p_midi_host->sysex_rx_buf[cable];
+  if (idx_buf != MIDIH_SYSEX_NO_ROOM)
+  {
+    midih_sysex_rx_buf_t *buf = &midih_sysex_arena[idx_buf];
+    if (!buf->truncated && buf->len + nbytes <= CFG_TUH_MIDI_SYSEX_BUFSIZE)
+    {
+      memcpy(buf->data + buf->len, packet + 1, nbytes);
+      buf->len += nbytes;
+    }
+    else
+    {
+      buf->truncated = true;
+    }
+  }
+  if (sysex & MIDIH_RX_SYSEX_END)
+  {
+    sysex_rx_finish(dev_addr, p_midi_host, cable, false);
+  }
 }
-bool midih_xfer_cb(uint8_t dev_addr, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes)
+#endif
+
+// Return true if midih_xfer_cb() has to pass the received packets through
+// route_rx_packets(). rx_sysex_active is only kept up to date while it does.
+static bool rx_route_on(midih_interface_t *p_midi_host)
 {
-  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
-  TU_VERIFY(p_midi_host != NULL);
-  p_midi_host->last_xfer_result = result;
-  if (result == XFER_RESULT_FAILED) {
-    TU_LOG2("MIDIH xfer result failed\r\n");
-    return false;
+#if CFG_MIDI_HOST_SYSEX_RX
+  if (tuh_midi_sysex_cb)
+  {
+    return true;
   }
-  TU_ASSERT(result == XFER_RESULT_SUCCESS);
+#endif
+#if CFG_MIDI_HOST_RX_FILTER
+  if (p_midi_host->rx_filter_on)
+  {
+    return true;
+  }
+#endif
+  return tuh_midi_rt_cb != NULL || p_midi_host->rx_overflow == TUH_MIDI_RX_DROP_SYSEX;
+}
 
-  if ( ep_addr == p_midi_host->ep_in)
+// Look at each of the npackets MIDI packets stored in words before they are
+// queued. Drop the packets the cable filters reject. Call
+// tuh_midi_rt_cb() for real-time messages and, unless
+// CFG_MIDI_HOST_RX_RT_FIFO is 1, take them out. If the application defines
+// tuh_midi_sysex_cb(), take out SysEx packets and assemble their messages
+// per cable with sysex_rx_add(). For TUH_MIDI_RX_DROP_SYSEX,
+// keep only whole messages that fit in the RX FIFO(s): a SysEx message that
+// loses a packet loses the rest of its packets too, so the data after the
+// gap never looks like part of the next message. The packets kept slide
+// down to the start of words. Return the number kept.
+static uint32_t route_rx_packets(uint8_t dev_addr, midih_interface_t *p_midi_host, uint32_t* words, uint32_t npackets)
+{
+  uint8_t const ncables = TU_MIN(p_midi_host->num_cables_rx, CFG_TUH_MAX_CABLES);
+  bool const drop_sysex = p_midi_host->rx_overflow == TUH_MIDI_RX_DROP_SYSEX;
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  uint16_t nkept_cable[CFG_TUH_MAX_CABLES];
+  tu_memclr(nkept_cable, sizeof(nkept_cable));
+#else
+  uint32_t const room = tu_fifo_remaining(&p_midi_host->rx_ff) / 4;
+#endif
+  uint32_t nkept = 0;
+  for (uint32_t idx = 0; idx < npackets; idx++)
   {
-    // receive new data if available
-    uint32_t packets_queued = 0;
-    if (xferred_bytes)
+    uint8_t const* packet = (uint8_t const*)(words + idx);
+    uint8_t const cable = packet[0] >> 4;
+    uint16_t const cable_mask = (uint16_t)(1u << cable);
+    uint8_t const status = packet[1];
+    if (cable >= ncables)
+    {
+      // the stream read functions ignore cables the device does not have
+      words[nkept++] = words[idx];
+      continue;
+    }
+    uint8_t nbytes;
+    uint8_t const sysex = rx_sysex_track(p_midi_host, packet, &nbytes);
+    (void) nbytes;
+    if (sysex & (MIDIH_RX_SYSEX_CUT | MIDIH_RX_SYSEX_START))
+    {
+      p_midi_host->rx_sysex_dropping &= (uint16_t)~cable_mask;
+    }
+#if CFG_MIDI_HOST_SYSEX_RX
+    if (tuh_midi_sysex_cb && (sysex & MIDIH_RX_SYSEX_CUT) &&
+        p_midi_host->sysex_rx_buf[cable] != MIDIH_SYSEX_NO_BUF)
+    {
+      // the previous message never got its 0xF7
+      sysex_rx_finish(dev_addr, p_midi_host, cable, true);
+    }
+#endif
+#if CFG_MIDI_HOST_RX_FILTER
+    // drop what the application filtered out before anything else sees it
+    if (p_midi_host->rx_filter_on && rx_filter_drop(p_midi_host, packet, sysex))
+    {
+      continue;
+    }
+#endif
+    if (status >= MIDI_STATUS_SYSREAL_TIMING_CLOCK && tuh_midi_rt_cb)
+    {
+      MIDIH_TRACE(RT_CB_ENTER, dev_addr, status);
+      tuh_midi_rt_cb(dev_addr, cable, status);
+      MIDIH_TRACE(RT_CB_EXIT, dev_addr, 0);
+#if !CFG_MIDI_HOST_RX_RT_FIFO
+      continue;
+#endif
+    }
+#if CFG_MIDI_HOST_SYSEX_RX
+    if (tuh_midi_sysex_cb && (sysex & MIDIH_RX_SYSEX))
+    {
+      // deliver SysEx messages whole instead of queueing them
+      sysex_rx_add(dev_addr, p_midi_host, packet, nbytes, sysex);
+      continue;
+    }
+#endif
+    if (drop_sysex)
     {
-      // put in the RX FIFO only non-zero MIDI IN 4-byte packets
-      uint8_t* buf = p_midi_host->epin_buf;
-      uint32_t npackets = xferred_bytes / 4;
-      uint32_t packet_num;
-      for (packet_num = 0; packet_num < npackets; packet_num++)
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+      // queue_rx_packets() drops the packets of cables without a queue
+      bool keep = cable >= midih_limits.max_cables ||
+        nkept_cable[cable] < tu_fifo_remaining(&p_midi_host->rx_cable_ff[cable]) / 4;
+#else
+      bool keep = nkept < room;
+#endif
+      if (sysex & MIDIH_RX_SYSEX)
       {
-        // some devices send back all zero packets even if there is no data ready
-        uint32_t packet = (uint32_t)((*buf)<<24) | ((uint32_t)(*(buf+1))<<16) | ((uint32_t)(*(buf+2))<<8) | ((uint32_t)(*(buf+3)));
-        if (packet != 0)
+        if (p_midi_host->rx_sysex_dropping & cable_mask)
+        {
+          keep = false;
+        }
+        else if (!keep)
+        {
+          p_midi_host->rx_sysex_dropping |= cable_mask;
+          MIDIH_STATS_ADD(p_midi_host, rx_dropped_sysex, 1);
+        }
+        if (sysex & MIDIH_RX_SYSEX_END)
         {
-          tu_fifo_write_n(&p_midi_host->rx_ff, buf, 4);
-          ++packets_queued;
-          TU_LOG3("MIDI RX=%08lx\r\n", packet);
+          p_midi_host->rx_sysex_dropping &= (uint16_t)~cable_mask;
         }
-        buf += 4;
       }
-      // invoke receive callback if available
-      if (tuh_midi_rx_cb && packets_queued)
+      if (!keep)
       {
-        tuh_midi_rx_cb(dev_addr, packets_queued);
+        MIDIH_STATS_ADD(p_midi_host, rx_dropped_packets, 1);
+        continue;
       }
     }
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+    ++nkept_cable[cable];
+#endif
+    words[nkept++] = words[idx];
+  }
+  return nkept;
+}
+
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+// Return the timestamp slot for the packet stored at ptr in an RX FIFO
+static uint32_t* rx_ts_slot(midih_interface_t *p_midi_host, void const* ptr)
+{
+  return p_midi_host->bufs->rx_ts_buf + ((uint8_t const*)ptr - p_midi_host->bufs->rx_ff_buf) / 4;
+}
 
-    TU_LOG2("Requesting poll IN endpoint %d\r\n", p_midi_host->ep_in);
-    TU_ASSERT(usbh_edpt_xfer(p_midi_host->dev_addr, p_midi_host->ep_in, p_midi_host->epin_buf, p_midi_host->ep_in_max), 0);
+// Record timestamp for the next npackets packets written to rx_ff.
+// Only stamp the slots that are free so queued packets keep their time.
+static void stamp_rx_packets(midih_interface_t *p_midi_host, tu_fifo_t *rx_ff, uint32_t npackets, uint32_t timestamp)
+{
+  tu_fifo_buffer_info_t info;
+  tu_fifo_get_write_info(rx_ff, &info);
+  uint32_t nlin = TU_MIN(npackets, (uint32_t)(info.len_lin / 4));
+  uint32_t nwrap = TU_MIN(npackets - nlin, (uint32_t)(info.len_wrap / 4));
+  if (nlin)
+  {
+    uint32_t *slot = rx_ts_slot(p_midi_host, info.ptr_lin);
+    for (uint32_t idx = 0; idx < nlin; idx++)
+      slot[idx] = timestamp;
   }
-  else if ( ep_addr == p_midi_host->ep_out )
+  if (nwrap)
   {
-    if (0 == write_flush(dev_addr, p_midi_host))
+    uint32_t *slot = rx_ts_slot(p_midi_host, info.ptr_wrap);
+    for (uint32_t idx = 0; idx < nwrap; idx++)
+      slot[idx] = timestamp;
+  }
+}
+#endif
+
+// Write npackets MIDI packets from words to rx_ff, making room or
+// dropping packets as the device's overflow policy says. Only whole
+// packets go in the FIFO. Return the number of packets written.
+static uint32_t write_rx_fifo(midih_interface_t *p_midi_host, tu_fifo_t *rx_ff, uint32_t* words, uint32_t npackets, uint32_t timestamp)
+{
+  (void) timestamp;
+  uint32_t const room = tu_fifo_remaining(rx_ff) / 4;
+  uint32_t nwrite = npackets;
+  uint32_t nold = 0;
+  // route_rx_packets() already made TUH_MIDI_RX_DROP_SYSEX traffic fit
+  if (npackets > room && p_midi_host->rx_overflow == TUH_MIDI_RX_DROP_OLDEST)
+  {
+    uint32_t const depth = tu_fifo_depth(rx_ff) / 4;
+    if (nwrite > depth)
     {
-      // If there is no data left, a ZLP should be sent if
-      // xferred_bytes is multiple of EP size and not zero
-      if ( !tu_fifo_count(&p_midi_host->tx_ff) && xferred_bytes && (0 == (xferred_bytes % p_midi_host->ep_out_max)) )
-      {
-        if ( usbh_edpt_claim(dev_addr, p_midi_host->ep_out) )
-        {
-          TU_ASSERT(usbh_edpt_xfer(dev_addr, p_midi_host->ep_out, XFER_RESULT_SUCCESS, 0));
-        }
-      }
+      // the newest packets would overwrite the first of these anyway
+      nold = nwrite - depth;
+      words += nold;
+      nwrite = depth;
     }
-    if (tuh_midi_tx_cb)
+    if (nwrite > room)
     {
-      tuh_midi_tx_cb(dev_addr);
+      tu_fifo_advance_read_pointer(rx_ff, (uint16_t)((nwrite - room) * 4));
+      nold += nwrite - room;
     }
+    npackets = nwrite;
   }
-
-  return true;
+  else if (npackets > room)
+  {
+    nwrite = room;
+  }
+  MIDIH_STATS_ADD(p_midi_host, rx_dropped_packets, npackets - nwrite);
+  MIDIH_STATS_ADD(p_midi_host, rx_discarded_packets, nold);
+  if (nwrite == 0)
+    return 0;
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+  stamp_rx_packets(p_midi_host, rx_ff, nwrite, timestamp);
+#endif
+  tu_fifo_write_n(rx_ff, words, (uint16_t)(nwrite * 4));
+  MIDIH_STATS_MAX(p_midi_host, rx_ff_high_water, tu_fifo_count(rx_ff));
+  MIDIH_TRACE(RX_LEVEL, p_midi_host->dev_addr, tu_fifo_count(rx_ff));
+  return nwrite;
 }
 
-void midih_close(uint8_t dev_addr)
+// Put npackets MIDI packets into the receive queue(s). Return the number
+// of packets queued.
+static uint32_t queue_rx_packets(midih_interface_t *p_midi_host, uint32_t* words, uint32_t npackets)
 {
-  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
-  if (p_midi_host == NULL)
-    return;
-  if (tuh_midi_umount_cb)
-    tuh_midi_umount_cb(dev_addr, 0);
-  tu_fifo_clear(&p_midi_host->rx_ff);
-  tu_fifo_clear(&p_midi_host->tx_ff);
-  p_midi_host->ep_in = 0;
-  p_midi_host->ep_in_max = 0;
-  p_midi_host->ep_out = 0;
-  p_midi_host->ep_out_max = 0;
-  p_midi_host->itf_num = 0;
-  p_midi_host->num_cables_rx = 0;
-  p_midi_host->num_cables_tx = 0;
-  p_midi_host->dev_addr = 255; // invalid
-  p_midi_host->configured = false;
-  tu_memclr(&p_midi_host->stream_read, sizeof(p_midi_host->stream_read));
-  tu_memclr(p_midi_host->stream_write, sizeof(p_midi_host->stream_write)*midih_limits.max_cables);
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+  uint32_t const timestamp = CFG_TUH_MIDI_TIME_US();
+#else
+  uint32_t const timestamp = 0;
+#endif
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  // sort the packets into the per-cable queues, one FIFO write per run of packets for the same cable
+  uint32_t nqueued = 0;
+  uint32_t idx = 0;
+  while (idx < npackets)
+  {
+    uint8_t const cable = ((uint8_t const*)(words + idx))[0] >> 4;
+    uint32_t run = 1;
+    while (idx + run < npackets && (((uint8_t const*)(words + idx + run))[0] >> 4) == cable)
+    {
+      ++run;
+    }
+    if (cable < midih_limits.max_cables)
+    {
+      nqueued += write_rx_fifo(p_midi_host, &p_midi_host->rx_cable_ff[cable], words + idx, run, timestamp);
+    }
+    else
+    {
+      MIDIH_STATS_ADD(p_midi_host, rx_dropped_packets, run);
+    }
+    idx += run;
+  }
+  return nqueued;
+#else
+  return write_rx_fifo(p_midi_host, &p_midi_host->rx_ff, words, npackets, timestamp);
+#endif
 }
 
-//--------------------------------------------------------------------+
-// Enumeration
-//--------------------------------------------------------------------+
-bool midih_open(uint8_t rhport, uint8_t dev_addr, tusb_desc_interface_t const *desc_itf, uint16_t max_len)
+// Return the queue the application should read packets from next
+static tu_fifo_t* get_rx_fifo(midih_interface_t *p_midi_host)
 {
-  (void) rhport;
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  if (p_midi_host->rx_cable_ff == NULL)
+    return &p_midi_host->rx_ff; // no device; always empty
+  // check the cables round robin so a busy cable cannot starve the others
+  uint8_t const ncables = midih_limits.max_cables;
+  for (uint8_t idx = 0; idx < ncables; idx++)
+  {
+    uint8_t const cable = (uint8_t)((p_midi_host->rx_next_cable + idx) % ncables);
+    if (!tu_fifo_empty(&p_midi_host->rx_cable_ff[cable]))
+    {
+      p_midi_host->rx_next_cable = (uint8_t)((cable + 1) % ncables);
+      return &p_midi_host->rx_cable_ff[cable];
+    }
+  }
+  return &p_midi_host->rx_cable_ff[p_midi_host->rx_next_cable];
+#else
+  return &p_midi_host->rx_ff;
+#endif
+}
 
-  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+// Return the number of bytes queued in the fullest RX FIFO and set
+// *p_room to the free space in it
+static uint16_t rx_fifo_level(midih_interface_t *p_midi_host, uint16_t *p_room)
+{
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  uint16_t level = 0;
+  *p_room = tu_fifo_depth(&p_midi_host->rx_cable_ff[0]);
+  for (uint8_t cable = 0; cable < midih_limits.max_cables; cable++)
+  {
+    uint16_t const count = tu_fifo_count(&p_midi_host->rx_cable_ff[cable]);
+    if (count > level)
+    {
+      level = count;
+      *p_room = tu_fifo_remaining(&p_midi_host->rx_cable_ff[cable]);
+    }
+  }
+  return level;
+#else
+  *p_room = tu_fifo_remaining(&p_midi_host->rx_ff);
+  return tu_fifo_count(&p_midi_host->rx_ff);
+#endif
+}
 
-  TU_VERIFY(p_midi_host != NULL);
+// Return the depth of each RX FIFO
+static uint16_t rx_fifo_depth(midih_interface_t *p_midi_host)
+{
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  return tu_fifo_depth(&p_midi_host->rx_cable_ff[0]);
+#else
+  return tu_fifo_depth(&p_midi_host->rx_ff);
+#endif
+}
+
+// With RX flow control on, restart IN polling once the application has
+// read the RX FIFO(s) down to the resume level
+static void rx_flow_resume(midih_interface_t *p_midi_host)
+{
+  if (!p_midi_host->rx_paused || !p_midi_host->configured || p_midi_host->last_xfer_result != XFER_RESULT_SUCCESS)
+    return;
+  uint16_t room;
+  uint16_t const level = rx_fifo_level(p_midi_host, &room);
+  if (level > p_midi_host->rx_resume_level)
+    return;
+  p_midi_host->rx_paused = false;
+  if (!usbh_edpt_xfer(p_midi_host->dev_addr, p_midi_host->ep_in, p_midi_host->epin_buf[p_midi_host->epin_idx], p_midi_host->ep_in_max))
+  {
+    p_midi_host->rx_paused = true; // try again on the next read
+    return;
+  }
+  MIDIH_TRACE(RX_RESUME, p_midi_host->dev_addr, level);
+  MIDIH_TRACE(IN_SUBMIT, p_midi_host->dev_addr, p_midi_host->ep_in_max);
+}
+
+// Turn RX flow control on or off. It needs room for two IN transfers in
+// each RX FIFO, or polling could never restart.
+static bool rx_flow_control(midih_interface_t *p_midi_host, bool enable, uint16_t resume_level)
+{
+  uint16_t const depth = rx_fifo_depth(p_midi_host);
+  if (enable)
+  {
+    TU_VERIFY(depth >= 2 * p_midi_host->ep_in_max);
+    // polling restarts only if the next transfer will fit
+    if (resume_level > depth - p_midi_host->ep_in_max)
+      resume_level = depth - p_midi_host->ep_in_max;
+    p_midi_host->rx_resume_level = resume_level;
+  }
+  else
+  {
+    p_midi_host->rx_resume_level = depth;
+  }
+  p_midi_host->rx_flow_control = enable;
+  rx_flow_resume(p_midi_host);
+  return true;
+}
+
+// Get the memory for pool entry idx
+static bool midih_alloc(int idx, midih_buffers_t *bufs)
+{
+#if CFG_MIDI_HOST_STATIC_ALLOC
+  bufs->rx_ff_buf = midih_rx_ff_bufs[idx];
+  bufs->tx_ff_buf = midih_tx_ff_bufs[idx];
+  bufs->stream_write = midih_stream_write_bufs[idx];
+  #if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  bufs->rx_cable_ff = midih_rx_cable_ff_bufs[idx];
+  #endif
+  #if CFG_MIDI_HOST_RX_TIMESTAMPS
+  bufs->rx_ts_buf = midih_rx_ts_bufs[idx];
+  #endif
+  #if CFG_MIDI_HOST_TX_SCHEDULE
+  bufs->tx_sched = midih_tx_sched_bufs[idx];
+  #endif
+#else
+  (void) idx;
+  bufs->rx_ff_buf = midih_allocator.alloc(midih_limits.midi_rx_buf);
+  bufs->tx_ff_buf = midih_allocator.alloc(midih_limits.midi_tx_buf);
+  bufs->stream_write = midih_allocator.alloc(midih_limits.max_cables * sizeof(midi_stream_t));
+  #if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  bufs->rx_cable_ff = midih_allocator.alloc(midih_limits.max_cables * sizeof(tu_fifo_t));
+  TU_ASSERT(bufs->rx_cable_ff != NULL);
+  #endif
+  #if CFG_MIDI_HOST_RX_TIMESTAMPS
+  bufs->rx_ts_buf = midih_allocator.alloc((midih_limits.midi_rx_buf / 4) * sizeof(uint32_t));
+  TU_ASSERT(bufs->rx_ts_buf != NULL);
+  #endif
+  #if CFG_MIDI_HOST_TX_SCHEDULE
+  bufs->tx_sched = midih_allocator.alloc(CFG_TUH_MIDI_TX_SCHED_DEPTH * sizeof(midih_sched_event_t));
+  TU_ASSERT(bufs->tx_sched != NULL);
+  #endif
+#endif
+  TU_ASSERT((bufs->rx_ff_buf != NULL && bufs->tx_ff_buf != NULL && bufs->stream_write != NULL));
+  bufs->in_use = false;
+  return true;
+}
+
+static void midih_free(void* ptr)
+{
+#if CFG_MIDI_HOST_STATIC_ALLOC
+  (void) ptr; // nothing to free
+#else
+  midih_allocator.free(ptr);
+#endif
+}
+
+static void midih_freeall(void)
+{
+  // free memory allocated by midih_init()
+  for (int idx = 0; idx < CFG_TUH_MIDI_DEVICE_MAX; idx++)
+  {
+    midih_buffers_t *bufs = &midih_pool[idx];
+    if (bufs->rx_ff_buf != NULL)
+    {
+      midih_free(bufs->rx_ff_buf);
+      bufs->rx_ff_buf = NULL;
+    }
+    if (bufs->tx_ff_buf != NULL)
+    {
+      midih_free(bufs->tx_ff_buf);
+      bufs->tx_ff_buf = NULL;
+    }
+    if (bufs->stream_write != NULL)
+    {
+      midih_free(bufs->stream_write);
+      bufs->stream_write = NULL;
+    }
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+    if (bufs->rx_cable_ff != NULL)
+    {
+      midih_free(bufs->rx_cable_ff);
+      bufs->rx_cable_ff = NULL;
+    }
+#endif
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+    if (bufs->rx_ts_buf != NULL)
+    {
+      midih_free(bufs->rx_ts_buf);
+      bufs->rx_ts_buf = NULL;
+    }
+#endif
+#if CFG_MIDI_HOST_TX_SCHEDULE
+    if (bufs->tx_sched != NULL)
+    {
+      midih_free(bufs->tx_sched);
+      bufs->tx_sched = NULL;
+    }
+#endif
+  }
+}
+
+// Give the FIFOs of a newly opened MIDI device storage from the pool
+static bool midih_bind_buffers(midih_interface_t *p_midi_host)
+{
+  if (p_midi_host->bufs != NULL)
+    return true;
+  midih_buffers_t *bufs = NULL;
+  for (int idx = 0; bufs == NULL && idx < CFG_TUH_MIDI_DEVICE_MAX; idx++)
+  {
+    if (!midih_pool[idx].in_use && midih_pool[idx].rx_ff_buf != NULL)
+    {
+      bufs = &midih_pool[idx];
+    }
+  }
+  if (bufs == NULL)
+  {
+    TU_LOG1("No buffers left for another MIDI device; increase CFG_TUH_MIDI_DEVICE_MAX\r\n");
+    return false;
+  }
+  bufs->in_use = true;
+  p_midi_host->bufs = bufs;
+
+  p_midi_host->stream_write = bufs->stream_write;
+  tu_memclr(p_midi_host->stream_write, sizeof(*(p_midi_host->stream_write))*midih_limits.max_cables);
+#if CFG_MIDI_HOST_STATS
+  tu_memclr(&p_midi_host->stats, sizeof(p_midi_host->stats));
+#endif
+#if CFG_MIDI_HOST_TX_SCHEDULE
+  p_midi_host->tx_sched = bufs->tx_sched;
+  p_midi_host->tx_sched_count = 0;
+#endif
+  // keep the RX FIFO a whole number of packets deep so packets never wrap (see tuh_midi_packet_peek())
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  // split the RX buffer evenly among the cables
+  uint16_t const cable_depth = (uint16_t)((midih_limits.midi_rx_buf / midih_limits.max_cables) & ~3u);
+  p_midi_host->rx_cable_ff = bufs->rx_cable_ff;
+  for (uint8_t cable = 0; cable < midih_limits.max_cables; cable++)
+  {
+    tu_fifo_config(&p_midi_host->rx_cable_ff[cable], bufs->rx_ff_buf + cable * cable_depth, cable_depth, 1, false);
+  #if CFG_FIFO_MUTEX
+    tu_fifo_config_mutex(&p_midi_host->rx_cable_ff[cable], NULL, p_midi_host->rx_mutex);
+  #endif
+  }
+  p_midi_host->rx_next_cable = 0;
+  p_midi_host->rx_peek_ff = &p_midi_host->rx_cable_ff[0];
+#else
+  tu_fifo_config(&p_midi_host->rx_ff, bufs->rx_ff_buf, midih_limits.midi_rx_buf & ~3u, 1, false);
+#endif
+  tu_fifo_config(&p_midi_host->tx_ff, bufs->tx_ff_buf, midih_limits.midi_tx_buf, 1, false);
+  return true;
+}
+
+// Detach the FIFOs from their storage and return it to the pool
+static void midih_release_buffers(midih_interface_t *p_midi_host)
+{
+  if (p_midi_host->bufs == NULL)
+    return;
+  p_midi_host->bufs->in_use = false;
+  p_midi_host->bufs = NULL;
+  p_midi_host->stream_write = NULL;
+#if CFG_MIDI_HOST_TX_SCHEDULE
+  p_midi_host->tx_sched = NULL;
+  p_midi_host->tx_sched_count = 0;
+#endif
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  p_midi_host->rx_cable_ff = NULL;
+  p_midi_host->rx_peek_ff = &p_midi_host->rx_ff;
+#endif
+  // FIFOs without storage always read as empty and full
+  tu_fifo_config(&p_midi_host->rx_ff, NULL, 0, 1, false);
+  tu_fifo_config(&p_midi_host->tx_ff, NULL, 0, 1, false);
+}
+
+//--------------------------------------------------------------------+
+// USBH API
+//--------------------------------------------------------------------+
+void tuh_midih_define_limits(size_t midi_rx_buffer_bytes, size_t midi_tx_buffer_bytes, uint8_t max_cables)
+{
+  // prevent memory leak in case midih_init() was called before this function
+  midih_freeall();
+#if CFG_MIDI_HOST_STATIC_ALLOC
+  // the static buffers cannot grow
+  if (midi_rx_buffer_bytes > CFG_TUH_MIDI_RX_BUFSIZE || midi_tx_buffer_bytes > CFG_TUH_MIDI_TX_BUFSIZE || max_cables > CFG_TUH_MAX_CABLES)
+  {
+    TU_LOG1("MIDI host limits exceed the static buffer sizes; clamping\r\n");
+  }
+  midi_rx_buffer_bytes = TU_MIN(midi_rx_buffer_bytes, CFG_TUH_MIDI_RX_BUFSIZE);
+  midi_tx_buffer_bytes = TU_MIN(midi_tx_buffer_bytes, CFG_TUH_MIDI_TX_BUFSIZE);
+  max_cables = TU_MIN(max_cables, CFG_TUH_MAX_CABLES);
+#endif
+  midih_limits.midi_rx_buf = midi_rx_buffer_bytes;
+  midih_limits.midi_tx_buf = midi_tx_buffer_bytes;
+  midih_limits.max_cables = max_cables;
+}
+
+#if !CFG_MIDI_HOST_STATIC_ALLOC
+void tuh_midih_set_allocator(void* (*alloc_fn)(size_t size), void (*free_fn)(void* ptr))
+{
+  // return anything allocated with the previous allocator to it
+  midih_freeall();
+  midih_allocator.alloc = alloc_fn ? alloc_fn : malloc;
+  midih_allocator.free = free_fn ? free_fn : free;
+}
+#endif
+
+bool midih_init(void)
+{
+  tu_memclr(&_midi_host, sizeof(_midi_host));
+  tu_memclr(&midih_pool, sizeof(midih_pool));
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  TU_ASSERT(((midih_limits.midi_rx_buf / midih_limits.max_cables) & ~3u) >= 4);
+#endif
+  for (int idx = 0; idx < CFG_TUH_MIDI_DEVICE_MAX; idx++)
+  {
+    TU_ASSERT(midih_alloc(idx, &midih_pool[idx]));
+  }
+  // config fifos; the RX and TX FIFOs get storage when a device is opened
+  for (int inst = 0; inst < CFG_TUH_DEVICE_MAX; inst++)
+  {
+    midih_interface_t *p_midi_host = &_midi_host[inst];
+    midih_release_buffers(p_midi_host);
+  #if CFG_TUH_MIDI_TX_RT_BUFSIZE
+    tu_fifo_config(&p_midi_host->tx_rt_ff, p_midi_host->tx_rt_ff_buf, CFG_TUH_MIDI_TX_RT_BUFSIZE & ~3u, 1, false);
+  #endif
+
+  #if CFG_FIFO_MUTEX
+  #if CFG_MIDI_HOST_RX_CABLE_QUEUES
+    // every cable queue has the same reader, so they can share the read mutex
+    p_midi_host->rx_mutex = osal_mutex_create(&p_midi_host->rx_ff_mutex);
+  #else
+    tu_fifo_config_mutex(&p_midi_host->rx_ff, NULL, osal_mutex_create(&p_midi_host->rx_ff_mutex));
+  #endif
+    tu_fifo_config_mutex(&p_midi_host->tx_ff, osal_mutex_create(&p_midi_host->tx_ff_mutex), NULL);
+  #if CFG_TUH_MIDI_TX_RT_BUFSIZE
+    tu_fifo_config_mutex(&p_midi_host->tx_rt_ff, osal_mutex_create(&p_midi_host->tx_rt_ff_mutex), NULL);
+  #endif
+  #endif
+  }
+  return true;
+}
+
+bool midih_deinit()
+{
+  midih_freeall();
+  return true;
+}
+#if CFG_MIDI_HOST_SYSEX_SEND
+// Finish the tuh_midi_sysex_send() message. Clear it first so done_cb
+// can start the next one.
+static void sysex_send_done(uint8_t dev_addr, midih_interface_t* p_midi_host, bool complete)
+{
+  uint8_t const* buffer = p_midi_host->sysex_buf;
+  tuh_midi_sysex_done_cb_t done_cb = p_midi_host->sysex_done_cb;
+  p_midi_host->sysex_buf = NULL;
+  p_midi_host->sysex_len = 0;
+  p_midi_host->sysex_pos = 0;
+  p_midi_host->sysex_ahead = 0;
+  p_midi_host->sysex_done_cb = NULL;
+  if (done_cb)
+  {
+    done_cb(dev_addr, buffer, complete);
+  }
+}
+#endif
+
+bool midih_xfer_cb(uint8_t dev_addr, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  p_midi_host->last_xfer_result = result;
+  if (result == XFER_RESULT_FAILED) {
+    TU_LOG2("MIDIH xfer result failed\r\n");
+    MIDIH_STATS_ADD(p_midi_host, xfer_failures, 1);
+    MIDIH_TRACE(XFER_FAILED, dev_addr, (ep_addr << 8) | result);
+    return false;
+  }
+  if (result == XFER_RESULT_STALLED) {
+    MIDIH_STATS_ADD(p_midi_host, xfer_stalls, 1);
+    MIDIH_TRACE(XFER_FAILED, dev_addr, (ep_addr << 8) | result);
+  }
+  TU_ASSERT(result == XFER_RESULT_SUCCESS);
+
+  if ( ep_addr == p_midi_host->ep_in)
+  {
+    // Keep the endpoint polled while this transfer's packets get processed:
+    // queue the next IN transfer on the other buffer first
+    uint8_t const done_idx = p_midi_host->epin_idx;
+    p_midi_host->epin_idx = done_idx ^ 1;
+    MIDIH_TRACE(IN_DONE, dev_addr, xferred_bytes);
+    bool polling = true;
+    if (p_midi_host->rx_flow_control)
+    {
+      // The packets in this transfer and the next transfer must both fit.
+      // If they might not, let the device NAK until the application reads.
+      uint16_t room;
+      (void) rx_fifo_level(p_midi_host, &room);
+      p_midi_host->rx_paused = room < xferred_bytes + p_midi_host->ep_in_max;
+    }
+    if (p_midi_host->rx_paused)
+    {
+      MIDIH_STATS_ADD(p_midi_host, rx_flow_pauses, 1);
+      MIDIH_TRACE(RX_PAUSE, dev_addr, 0);
+    }
+    else
+    {
+      TU_LOG2("Requesting poll IN endpoint %d\r\n", p_midi_host->ep_in);
+      polling = usbh_edpt_xfer(p_midi_host->dev_addr, p_midi_host->ep_in, p_midi_host->epin_buf[p_midi_host->epin_idx], p_midi_host->ep_in_max);
+      if (polling)
+      {
+        MIDIH_TRACE(IN_SUBMIT, dev_addr, p_midi_host->ep_in_max);
+      }
+    }
+
+    // receive new data if available
+    uint32_t packets_queued = 0;
+    MIDIH_STATS_ADD(p_midi_host, rx_xfers, 1);
+    MIDIH_STATS_ADD(p_midi_host, rx_bytes, xferred_bytes);
+    if (xferred_bytes)
+    {
+      uint32_t *words = p_midi_host->epin_words[done_idx];
+      // put in the RX FIFO only non-zero MIDI IN 4-byte packets;
+      // some devices send back all zero packets even if there is no data ready
+      packets_queued = compact_rx_packets(words, xferred_bytes / 4);
+      MIDIH_STATS_ADD(p_midi_host, rx_packets, packets_queued);
+      MIDIH_STATS_ADD(p_midi_host, rx_zero_packets, xferred_bytes / 4 - packets_queued);
+      // filter, handle real-time and SysEx messages and drop whole messages that do not fit
+      if (packets_queued && rx_route_on(p_midi_host))
+      {
+        packets_queued = route_rx_packets(dev_addr, p_midi_host, words, packets_queued);
+      }
+      if (packets_queued)
+      {
+        TU_LOG3("MIDI RX %lu packets\r\n", packets_queued);
+        TU_LOG3_MEM(p_midi_host->epin_buf[done_idx], packets_queued * 4, 2);
+        // only count the packets that made it into the queue(s)
+        packets_queued = queue_rx_packets(p_midi_host, words, packets_queued);
+        MIDIH_TRACE(RX_QUEUED, dev_addr, packets_queued);
+      }
+      // invoke receive callback if available
+      if (tuh_midi_rx_cb && packets_queued)
+      {
+        MIDIH_TRACE(RX_CB_ENTER, dev_addr, packets_queued);
+        tuh_midi_rx_cb(dev_addr, packets_queued);
+        MIDIH_TRACE(RX_CB_EXIT, dev_addr, 0);
+      }
+    }
+    // a device that sends MIDI data keeps due packets going out even
+    // while the OUT endpoint is idle
+    tx_service(dev_addr, p_midi_host);
+    TU_ASSERT(polling, 0);
+  }
+  else if ( ep_addr == p_midi_host->ep_out )
+  {
+    MIDIH_STATS_ADD(p_midi_host, tx_xfers, 1);
+    MIDIH_STATS_ADD(p_midi_host, tx_bytes, xferred_bytes);
+    MIDIH_TRACE(OUT_DONE, dev_addr, xferred_bytes);
+#if CFG_MIDI_HOST_SYSEX_SEND
+    bool const sysex_done = p_midi_host->sysex_end_sent;
+    p_midi_host->sysex_end_sent = false;
+#endif
+    tx_sched_service(p_midi_host);
+    if (0 == write_flush(dev_addr, p_midi_host))
+    {
+      // If there is no data left, a ZLP should be sent if
+      // xferred_bytes is multiple of EP size and not zero
+      if ( !tx_fifo_count(p_midi_host) && xferred_bytes && (0 == (xferred_bytes % p_midi_host->ep_out_max)) )
+      {
+        if ( usbh_edpt_claim(dev_addr, p_midi_host->ep_out) )
+        {
+          TU_ASSERT(usbh_edpt_xfer(dev_addr, p_midi_host->ep_out, XFER_RESULT_SUCCESS, 0));
+          MIDIH_STATS_ADD(p_midi_host, tx_zlps, 1);
+          MIDIH_TRACE(OUT_SUBMIT, dev_addr, 0);
+        }
+      }
+    }
+#if CFG_MIDI_HOST_SYSEX_SEND
+    if (sysex_done)
+    {
+      sysex_send_done(dev_addr, p_midi_host, true);
+    }
+#endif
+    if (tuh_midi_tx_cb)
+    {
+      MIDIH_TRACE(TX_CB_ENTER, dev_addr, 0);
+      tuh_midi_tx_cb(dev_addr);
+      MIDIH_TRACE(TX_CB_EXIT, dev_addr, 0);
+    }
+  }
+
+  return true;
+}
+
+void midih_close(uint8_t dev_addr)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  if (p_midi_host == NULL)
+    return;
+  MIDIH_TRACE(UMOUNT, dev_addr, 0);
+#if CFG_MIDI_HOST_SYSEX_SEND
+  if (p_midi_host->sysex_buf != NULL)
+  {
+    sysex_send_done(dev_addr, p_midi_host, false);
+  }
+  p_midi_host->sysex_end_staged = false;
+  p_midi_host->sysex_end_sent = false;
+#endif
+#if CFG_MIDI_HOST_SYSEX_RX
+  if (p_midi_host->configured)
+  {
+    sysex_rx_release(p_midi_host);
+  }
+#endif
+  if (tuh_midi_umount_cb)
+    tuh_midi_umount_cb(dev_addr, 0);
+  midih_release_buffers(p_midi_host);
+#if CFG_TUH_MIDI_TX_RT_BUFSIZE
+  tu_fifo_clear(&p_midi_host->tx_rt_ff);
+#endif
+  p_midi_host->ep_in = 0;
+  p_midi_host->ep_in_max = 0;
+  p_midi_host->ep_out = 0;
+  p_midi_host->ep_out_max = 0;
+  p_midi_host->itf_num = 0;
+  p_midi_host->num_cables_rx = 0;
+  p_midi_host->num_cables_tx = 0;
+  p_midi_host->dev_addr = 255; // invalid
+  p_midi_host->configured = false;
+  p_midi_host->cable_sysex_in_progress = 0;
+  p_midi_host->epout_idx = 0;
+  p_midi_host->epout_staged = 0;
+  p_midi_host->epout_rt_staged = false;
+  p_midi_host->auto_flush = false;
+  p_midi_host->tx_hold_us = 0;
+  p_midi_host->tx_holding = false;
+  p_midi_host->tx_flush_held = false;
+  p_midi_host->rx_flow_control = false;
+  p_midi_host->rx_paused = false;
+}
+
+//--------------------------------------------------------------------+
+// Enumeration
+//--------------------------------------------------------------------+
+bool midih_open(uint8_t rhport, uint8_t dev_addr, tusb_desc_interface_t const *desc_itf, uint16_t max_len)
+{
+  (void) rhport;
+
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+
+  TU_VERIFY(p_midi_host != NULL);
   p_midi_host->last_xfer_result = XFER_RESULT_SUCCESS;
 #if CFG_MIDI_HOST_DEVSTRINGS
   p_midi_host->num_string_indices = 0;
@@ -542,6 +1591,13 @@ bool midih_open(uint8_t rhport, uint8_t dev_addr, tusb_desc_interface_t const *d
       }
   }
 #endif
+  // Now that this is known to be a MIDI interface, give it buffers
+  if (!midih_bind_buffers(p_midi_host))
+  {
+    p_midi_host->num_cables_rx = 0;
+    p_midi_host->num_cables_tx = 0;
+    return false;
+  }
   if (in_desc)
   {
     TU_ASSERT(tuh_edpt_open(dev_addr, in_desc));
@@ -572,9 +1628,33 @@ bool midih_set_config(uint8_t dev_addr, uint8_t itf_num)
   midih_interface_t *p_midi_host = get_midi_host(dev_addr);
   TU_VERIFY(p_midi_host != NULL);
   p_midi_host->configured = true;
+  p_midi_host->auto_flush = CFG_MIDI_HOST_AUTO_FLUSH;
+  p_midi_host->tx_hold_us = CFG_MIDI_HOST_TX_HOLD_US;
+  p_midi_host->tx_holding = false;
+  p_midi_host->tx_flush_held = false;
+  p_midi_host->rx_overflow = (tuh_midi_rx_overflow_t)CFG_MIDI_HOST_RX_OVERFLOW;
+  p_midi_host->rx_sysex_active = 0;
+  p_midi_host->rx_sysex_dropping = 0;
+#if CFG_MIDI_HOST_RX_FILTER
+  tu_memclr(p_midi_host->rx_filter_types, sizeof(p_midi_host->rx_filter_types));
+  tu_memclr(p_midi_host->rx_filter_channels, sizeof(p_midi_host->rx_filter_channels));
+  p_midi_host->rx_filter_sysex = 0;
+  p_midi_host->rx_filter_on = false;
+#endif
+#if CFG_MIDI_HOST_SYSEX_RX
+  memset(p_midi_host->sysex_rx_buf, MIDIH_SYSEX_NO_BUF, sizeof(p_midi_host->sysex_rx_buf));
+#endif
+  p_midi_host->rx_paused = false;
+  p_midi_host->rx_flow_control = false;
+#if CFG_MIDI_HOST_RX_FLOW_CONTROL
+  (void) rx_flow_control(p_midi_host, true, rx_fifo_depth(p_midi_host) / 2);
+#endif
 
   TU_LOG2("Requesting poll IN endpoint %d\r\n", p_midi_host->ep_in);
-  TU_ASSERT(usbh_edpt_xfer(p_midi_host->dev_addr, p_midi_host->ep_in, p_midi_host->epin_buf, p_midi_host->ep_in_max), 0);
+  p_midi_host->epin_idx = 0;
+  TU_ASSERT(usbh_edpt_xfer(p_midi_host->dev_addr, p_midi_host->ep_in, p_midi_host->epin_buf[0], p_midi_host->ep_in_max), 0);
+  MIDIH_TRACE(IN_SUBMIT, dev_addr, p_midi_host->ep_in_max);
+  MIDIH_TRACE(MOUNT, dev_addr, (p_midi_host->num_cables_tx << 8) | p_midi_host->num_cables_rx);
   if (tuh_midi_mount_cb)
   {
     tuh_midi_mount_cb(dev_addr, p_midi_host->ep_in, p_midi_host->ep_out, p_midi_host->num_cables_rx, p_midi_host->num_cables_tx);
@@ -586,37 +1666,270 @@ bool midih_set_config(uint8_t dev_addr, uint8_t itf_num)
 //--------------------------------------------------------------------+
 // Stream API
 //--------------------------------------------------------------------+
-static uint32_t write_flush(uint8_t dev_addr, midih_interface_t* midi)
+// Return the number of bytes queued to send in both TX FIFOs and the staged OUT buffer
+static uint32_t tx_fifo_count(midih_interface_t* midi)
 {
-  // No data to send
-  if ( !tu_fifo_count(&midi->tx_ff) ) return 0;
-  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
-  TU_VERIFY(p_midi_host != NULL);
-  if (p_midi_host->last_xfer_result != XFER_RESULT_SUCCESS) return 0;
-
-  // skip if previous transfer not complete
-  TU_VERIFY( usbh_edpt_claim(dev_addr, midi->ep_out) );
+  uint32_t count = midi->epout_staged + tu_fifo_count(&midi->tx_ff);
+#if CFG_TUH_MIDI_TX_RT_BUFSIZE
+  count += tu_fifo_count(&midi->tx_rt_ff);
+#endif
+#if CFG_MIDI_HOST_SYSEX_SEND
+  // the packets the rest of the SysEx message will take
+  count += (midi->sysex_len - midi->sysex_pos + 2) / 3 * 4;
+#endif
+  return count;
+}
 
-  uint16_t count = tu_fifo_read_n(&midi->tx_ff, midi->epout_buf, midi->ep_out_max);
+// Queue a real-time packet ahead of everything in tx_ff if there is room
+static bool write_rt_packet(midih_interface_t* midi, uint8_t const packet[4])
+{
+#if CFG_TUH_MIDI_TX_RT_BUFSIZE
+  TU_VERIFY(tu_fifo_remaining(&midi->tx_rt_ff) >= 4);
+  return tu_fifo_write_n(&midi->tx_rt_ff, packet, 4) == 4;
+#else
+  (void) midi;
+  (void) packet;
+  return false;
+#endif
+}
 
-  if (count)
+#if CFG_MIDI_HOST_SYSEX_SEND
+// Encode the next part of the SysEx message straight from the caller's
+// buffer into room bytes of USB MIDI packets at buf. Return the number of
+// bytes used.
+static uint16_t stage_sysex(midih_interface_t* midi, uint8_t* buf, uint16_t room)
+{
+  uint8_t const cable = (uint8_t)(midi->sysex_cable << 4);
+  uint8_t const* data = midi->sysex_buf + midi->sysex_pos;
+  uint32_t left = midi->sysex_len - midi->sysex_pos;
+  uint16_t count = 0;
+  for (; left > 3 && count + 4 <= room; count += 4, data += 3, left -= 3)
   {
-    TU_ASSERT( usbh_edpt_xfer(dev_addr, midi->ep_out, midi->epout_buf, count), 0 );
-    return count;
-  }else
+    buf[count] = cable | MIDI_CIN_SYSEX_START;
+    buf[count+1] = data[0];
+    buf[count+2] = data[1];
+    buf[count+3] = data[2];
+  }
+  if (left <= 3 && count + 4 <= room)
+  {
+    // the last 1 to 3 bytes, ending with 0xF7, pick the CIN
+    buf[count] = (uint8_t)(cable | (MIDI_CIN_SYSEX_END_1BYTE + left - 1));
+    buf[count+1] = data[0];
+    buf[count+2] = left > 1 ? data[1] : 0;
+    buf[count+3] = left > 2 ? data[2] : 0;
+    count += 4;
+    left = 0;
+    midi->sysex_end_staged = true;
+  }
+  midi->sysex_pos = midi->sysex_len - left;
+  return count;
+}
+#endif
+
+// Pack as much of the TX FIFOs as fits into the next OUT transfer in
+// epout_buf[epout_idx]. Return the number of bytes it holds.
+static uint16_t stage_out_buffer(midih_interface_t* midi)
+{
+  uint8_t *buf = midi->epout_buf[midi->epout_idx];
+  uint16_t count = midi->epout_staged;
+#if CFG_TUH_MIDI_TX_RT_BUFSIZE
+  // real-time messages go first so they do not wait behind long SysEx messages
+  uint16_t const rt_count = tu_fifo_read_n(&midi->tx_rt_ff, buf + count, (midi->ep_out_max - count) & ~3u);
+  midi->epout_rt_staged |= rt_count != 0;
+  count += rt_count;
+#endif
+#if CFG_MIDI_HOST_SYSEX_SEND
+  if (midi->sysex_pos < midi->sysex_len)
+  {
+    // packets queued before the SysEx message go out first; the ones
+    // queued after it wait until it has all been packed
+    uint16_t const nahead = tu_fifo_read_n(&midi->tx_ff, buf + count, TU_MIN(midi->sysex_ahead, midi->ep_out_max - count));
+    midi->sysex_ahead -= nahead;
+    count += nahead;
+    if (midi->sysex_ahead == 0)
+    {
+      count += stage_sysex(midi, buf + count, (midi->ep_out_max - count) & ~3u);
+    }
+    midi->epout_staged = count;
+    return count;
+  }
+#endif
+  count += tu_fifo_read_n(&midi->tx_ff, buf + count, midi->ep_out_max - count);
+  midi->epout_staged = count;
+  return count;
+}
+
+#if CFG_TUH_MIDI_TX_RT_BUFSIZE
+// Call with the OUT endpoint claimed. Put the real-time packets queued
+// since epout_buf[epout_idx] was packed in front of what it holds, so they
+// do not wait behind a full buffer for another transfer. The packed bytes
+// that no longer fit move to the start of the other buffer, which is free
+// until this one is submitted. Return the number of bytes moved.
+static uint16_t stage_rt_first(midih_interface_t* midi)
+{
+  uint16_t const count = midi->epout_staged;
+  uint16_t const nrt = (uint16_t)(TU_MIN(tu_fifo_count(&midi->tx_rt_ff), midi->ep_out_max) & ~3u);
+  if (count == 0 || nrt == 0)
+    return 0;
+  uint8_t *buf = midi->epout_buf[midi->epout_idx];
+  uint16_t const keep = (uint16_t)TU_MIN(count, midi->ep_out_max - nrt);
+  memcpy(midi->epout_buf[midi->epout_idx ^ 1], buf + keep, count - keep);
+  memmove(buf + nrt, buf, keep);
+  tu_fifo_read_n(&midi->tx_rt_ff, buf, nrt);
+  midi->epout_staged = (uint16_t)(nrt + keep);
+  midi->epout_rt_staged = true;
+  return (uint16_t)(count - keep);
+}
+#endif
+
+// Make the coalescing policy send everything queued at the next flush
+static void tx_hold_expire(midih_interface_t* midi)
+{
+#if CFG_MIDI_HOST_TX_COALESCING
+  midi->tx_holding = true;
+  midi->tx_hold_start = CFG_TUH_MIDI_TIME_US() - midi->tx_hold_us;
+#else
+  (void) midi;
+#endif
+}
+
+// Return true if the coalescing policy says to keep waiting for more TX data
+static bool tx_hold(midih_interface_t* midi)
+{
+  if (midi->tx_hold_us == 0 || !midi->tx_holding)
+    return false;
+#if CFG_TUH_MIDI_TX_RT_BUFSIZE
+  if (midi->epout_rt_staged || !tu_fifo_empty(&midi->tx_rt_ff))
+    return false;
+#endif
+  if (tx_fifo_count(midi) >= midi->ep_out_max)
+    return false;
+#if CFG_MIDI_HOST_TX_COALESCING
+  return (uint32_t)(CFG_TUH_MIDI_TIME_US() - midi->tx_hold_start) < midi->tx_hold_us;
+#else
+  return false;
+#endif
+}
+
+static uint32_t write_flush(uint8_t dev_addr, midih_interface_t* midi)
+{
+  // No data to send
+  if ( !tx_fifo_count(midi) ) return 0;
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  if (p_midi_host->last_xfer_result != XFER_RESULT_SUCCESS) return 0;
+  MIDIH_TRACE(FLUSH, dev_addr, tx_fifo_count(midi));
+
+  if ( !usbh_edpt_claim(dev_addr, midi->ep_out) )
+  {
+    // previous transfer not complete; get the next one ready so
+    // midih_xfer_cb() only has to submit it
+    stage_out_buffer(midi);
+    return 0;
+  }
+
+#if CFG_TUH_MIDI_TX_RT_BUFSIZE
+  // real-time packets queued while the last transfer was on the bus
+  // jump ahead of the transfer packed then; a buffer with real-time
+  // packets is never held, so what they push out goes in the next one
+  uint16_t const spilled = stage_rt_first(midi);
+#else
+  uint16_t const spilled = 0;
+#endif
+  uint16_t const count = stage_out_buffer(midi);
+  if (count && !tx_hold(midi))
+  {
+    uint8_t *buf = midi->epout_buf[midi->epout_idx];
+    midi->epout_idx ^= 1;
+    midi->epout_staged = spilled;
+    midi->epout_rt_staged = false;
+#if CFG_MIDI_HOST_SYSEX_SEND
+    // if the end of a SysEx message was pushed out, report it one
+    // transfer late rather than early
+    midi->sysex_end_sent = midi->sysex_end_staged && spilled == 0;
+    midi->sysex_end_staged = midi->sysex_end_staged && spilled != 0;
+#endif
+    TU_ASSERT( usbh_edpt_xfer(dev_addr, midi->ep_out, buf, count), 0 );
+    MIDIH_TRACE(OUT_SUBMIT, dev_addr, count);
+    // pack the following transfer while this one is on the bus. Anything
+    // still queued keeps the old hold start so it is not held any longer
+    stage_out_buffer(midi);
+    midi->tx_holding = tx_fifo_count(midi) != 0;
+    return count;
+  }else
   {
     // Release endpoint since we don't make any transfer
+    if (count)
+    {
+      midi->tx_flush_held = true;
+      MIDIH_TRACE(TX_HELD, dev_addr, tx_fifo_count(midi));
+    }
     usbh_edpt_release(dev_addr, midi->ep_out);
     return 0;
   }
 }
 
+// The write functions call this after they queue packets. It starts the
+// coalescing hold time and, in auto-flush mode, starts sending. If the OUT
+// endpoint is busy, midih_xfer_cb() sends the packets when the transfer completes.
+static void tx_queued(uint8_t dev_addr, midih_interface_t* midi)
+{
+  MIDIH_STATS_MAX(midi, tx_ff_high_water, tu_fifo_count(&midi->tx_ff));
+#if CFG_MIDI_HOST_TX_COALESCING
+  if (midi->tx_hold_us && !midi->tx_holding)
+  {
+    midi->tx_holding = true;
+    midi->tx_hold_start = CFG_TUH_MIDI_TIME_US();
+  }
+#endif
+  if (midi->auto_flush)
+  {
+    write_flush(dev_addr, midi);
+  }
+}
+
 bool tuh_midi_can_write_stream (uint8_t dev_addr)
 {
   midih_interface_t *p_midi_host = get_midi_host(dev_addr);
   return (tu_fifo_remaining(&p_midi_host->tx_ff) >= 4);
 }
 
+// Encoding of the USB MIDI packet that starts with a given status byte.
+// Bits 3:0 are the Code Index Number (CIN) and bits 7:4 are the number
+// of packet bytes the message fills, including the packet header byte.
+#define MIDI_STATUS_INFO(cin_, total_) (uint8_t)(((total_) << 4) | (cin_))
+#define MIDI_STATUS_INFO_CIN(info_) ((info_) & 0x0F)
+#define MIDI_STATUS_INFO_TOTAL(info_) ((info_) >> 4)
+
+// Indexed by the high nibble of a channel status byte minus 8 (0x80-0xEF).
+// This is also the CIN of a channel message packet, so running status
+// uses it to look up the length from the previous packet's CIN.
+static const uint8_t midi_channel_status_info[7] = {
+  MIDI_STATUS_INFO(MIDI_CIN_NOTE_OFF, 4),
+  MIDI_STATUS_INFO(MIDI_CIN_NOTE_ON, 4),
+  MIDI_STATUS_INFO(MIDI_CIN_POLY_KEYPRESS, 4),
+  MIDI_STATUS_INFO(MIDI_CIN_CONTROL_CHANGE, 4),
+  MIDI_STATUS_INFO(MIDI_CIN_PROGRAM_CHANGE, 3),
+  MIDI_STATUS_INFO(MIDI_CIN_CHANNEL_PRESSURE, 3),
+  MIDI_STATUS_INFO(MIDI_CIN_PITCH_BEND_CHANGE, 4),
+};
+
+// Indexed by the low nibble of a system exclusive or system common status byte (0xF0-0xF7).
+// Undefined status bytes, Tune Request and a stray SysEx End are sent as single bytes.
+static const uint8_t midi_system_status_info[8] = {
+  MIDI_STATUS_INFO(MIDI_CIN_SYSEX_START, 4),   // 0xF0 SysEx Start
+  MIDI_STATUS_INFO(MIDI_CIN_SYSCOM_2BYTE, 3),  // 0xF1 MTC Quarter Frame
+  MIDI_STATUS_INFO(MIDI_CIN_SYSCOM_3BYTE, 4),  // 0xF2 Song Position Pointer
+  MIDI_STATUS_INFO(MIDI_CIN_SYSCOM_2BYTE, 3),  // 0xF3 Song Select
+  MIDI_STATUS_INFO(MIDI_CIN_1BYTE_DATA, 2),    // 0xF4 undefined
+  MIDI_STATUS_INFO(MIDI_CIN_1BYTE_DATA, 2),    // 0xF5 undefined
+  MIDI_STATUS_INFO(MIDI_CIN_1BYTE_DATA, 2),    // 0xF6 Tune Request
+  MIDI_STATUS_INFO(MIDI_CIN_1BYTE_DATA, 2),    // 0xF7 SysEx End
+};
+
+// Number of packets tuh_midi_stream_write() collects before it writes them to the TX FIFO
+#define MIDI_STREAM_WRITE_BATCH 16
+
 uint32_t tuh_midi_stream_write (uint8_t dev_addr, uint8_t cable_num, uint8_t const* buffer, uint32_t bufsize)
 {
   midih_interface_t *p_midi_host = get_midi_host(dev_addr);
@@ -628,32 +1941,48 @@ uint32_t tuh_midi_stream_write (uint8_t dev_addr, uint8_t cable_num, uint8_t con
   uint32_t i = 0;
   uint8_t const CN_ = cable_num << 4;
 
-  while ( (i < bufsize) && (tu_fifo_remaining(&p_midi_host->tx_ff) >= 4) )
+  // Check the FIFO space once; every packet staged below uses up one packet of it
+  uint32_t packets_free = tu_fifo_remaining(&p_midi_host->tx_ff) / 4;
+  uint8_t staged[MIDI_STREAM_WRITE_BATCH*4];
+  uint32_t nstaged = 0;
+
+  while ( i < bufsize )
   {
     uint8_t const data = buffer[i];
+
+    if (data >= MIDI_STATUS_SYSREAL_TIMING_CLOCK)
+    {
+      // real-time messages need to be sent right away; use the
+      // priority lane, which does not need space in tx_ff
+      uint8_t const rt_packet[4] = {(uint8_t)(CN_ + MIDI_CIN_1BYTE_DATA), data, 0, 0};
+      if (write_rt_packet(p_midi_host, rt_packet))
+      {
+        i++;
+        continue;
+      }
+    }
+    if (!packets_free)
+    {
+      break;
+    }
     i++;
 
     if (data >= MIDI_STATUS_SYSREAL_TIMING_CLOCK)
     {
-        // real-time messages need to be sent right away
-        midi_stream_t streamrt;
-        streamrt.buffer[0] = CN_ + MIDI_CIN_1BYTE_DATA;
-        streamrt.buffer[1] = data;
-        streamrt.buffer[2] = 0;
-        streamrt.buffer[3] = 0;
-
-        uint16_t const count = tu_fifo_write_n(&p_midi_host->tx_ff, streamrt.buffer, 4);
-        // FIFO overflown, since we already check fifo remaining. It is probably race condition
-        TU_ASSERT(count == 4, i);
+      // the priority lane is full, so queue the message in order
+      uint8_t* packet = staged + nstaged*4;
+      packet[0] = CN_ + MIDI_CIN_1BYTE_DATA;
+      packet[1] = data;
+      packet[2] = 0;
+      packet[3] = 0;
+      ++nstaged;
+      --packets_free;
     }
     else if ( stream->index == 0 )
     {
       //------------- New event packet -------------//
-
-      uint8_t const msg = data >> 4;
       uint8_t const _msg = (stream->buffer[0]) & 0x0F;
       stream->index = 2;
-      //stream->buffer[1] = data; //first check if its a running status byte, then update
       stream->total = 4;
 
       // Check to see if we're still in a SysEx transmit.
@@ -667,73 +1996,46 @@ uint32_t tuh_midi_stream_write (uint8_t dev_addr, uint8_t cable_num, uint8_t con
           stream->total = 2;
         }
       }
-      else if (msg < 0x8 && _msg >= 0x8 && _msg < 0xF)   //Running Status ?
-      {
-        //stream->buffer[0] leave;
-        //stream->buffer[1] leave;
-        stream->buffer[2] = data;
-
-        if (_msg < 0xC || _msg == 0xE)
-        {
-            stream->index = 3;
-        }
-        else    //if (_msg < 0xF)
-        {
-            stream->index = 3;
-            stream->total = 3;
-        }
-      }
-      else if ( (msg >= 0x8 && msg <= 0xB) || msg == 0xE )
-      {
-        // Channel Voice Messages
-        stream->buffer[1] = data;
-        stream->buffer[0] = CN_ + msg;
-      }
-      else if ( msg == 0xC || msg == 0xD)
+      else if (data <= MIDI_MAX_DATA_VAL)
       {
-        // Channel Voice Messages, two-byte variants (Program Change and Channel Pressure)
-        stream->buffer[1] = data;
-        stream->buffer[0] = CN_ + msg;
-        stream->total = 3;
-      }
-      else if ( msg == 0xf )
-      {
-        // System message
-        stream->buffer[1] = data;
-
-        if ( data == MIDI_STATUS_SYSEX_START )
+        if (_msg >= MIDI_CIN_NOTE_OFF && _msg < MIDI_CIN_1BYTE_DATA)
         {
-          stream->buffer[0] = CN_ + MIDI_CIN_SYSEX_START;
+          // Running Status: keep stream->buffer[0] and stream->buffer[1]
+          stream->buffer[2] = data;
+          stream->index = 3;
+          stream->total = MIDI_STATUS_INFO_TOTAL(midi_channel_status_info[_msg - MIDI_CIN_NOTE_OFF]);
         }
-        else if ( data == MIDI_STATUS_SYSCOM_TIME_CODE_QUARTER_FRAME || data == MIDI_STATUS_SYSCOM_SONG_SELECT )
-        {
-          stream->buffer[0] = CN_ + MIDI_CIN_SYSCOM_2BYTE;
-          stream->total = 3;
-        }
-        else if ( data == MIDI_STATUS_SYSCOM_SONG_POSITION_POINTER )
-        {
-          stream->buffer[0] = CN_ + MIDI_CIN_SYSCOM_3BYTE;
-        }
-        else        //for example, MIDI_STATUS_SYSCOM_TUNE_REQUEST
+        else
         {
+          // Pack individual bytes if we don't support packing them into words.
+          stream->buffer[1] = data;
           stream->buffer[0] = CN_ + MIDI_CIN_1BYTE_DATA;
           stream->total = 2;
         }
       }
       else
       {
-        // Pack individual bytes if we don't support packing them into words.
+        // Channel Voice, System Exclusive or System Common status byte
+        uint8_t const info = (data < MIDI_STATUS_SYSEX_START) ?
+          midi_channel_status_info[(data >> 4) - MIDI_CIN_NOTE_OFF] : midi_system_status_info[data & 0x07];
+        stream->buffer[0] = CN_ + MIDI_STATUS_INFO_CIN(info);
         stream->buffer[1] = data;
-        stream->buffer[0] = CN_ + 0xF;
-        stream->index = 2;
-        stream->total = 2;
+        stream->total = MIDI_STATUS_INFO_TOTAL(info);
       }
     }   //End of: if (stream->index == 0)
     else
     {
       //------------- On-going (buffering) packet -------------//
 
-      TU_ASSERT(stream->index < 4, i);
+      if (stream->index >= 4)
+      {
+        // corrupt stream state; refuse this byte but still queue the
+        // packets staged so far, since they are counted in i
+        TU_LOG1("MIDI stream write state corrupt\r\n");
+        stream->index = 0;
+        --i;
+        break;
+      }
       stream->buffer[stream->index] = data;
       stream->index++;
       // See if this byte ends a SysEx.
@@ -744,22 +2046,36 @@ uint32_t tuh_midi_stream_write (uint8_t dev_addr, uint8_t cable_num, uint8_t con
       }
     }
 
-    // Send out packet
+    // Stage the packet if it is complete
     if ( stream->index >= 2 && stream->index >= stream->total )
     {
       //zeroes unused bytes
       for(uint8_t idx = stream->total; idx < 4; idx++) stream->buffer[idx] = 0;
       TU_LOG3_MEM(stream->buffer, 4, 2);
 
-      uint16_t const count = tu_fifo_write_n(&p_midi_host->tx_ff, stream->buffer, 4);
-
+      memcpy(staged + nstaged*4, stream->buffer, 4);
+      ++nstaged;
+      --packets_free;
       stream->index = 0;
+    }
 
+    if (nstaged == MIDI_STREAM_WRITE_BATCH)
+    {
+      uint16_t const count = tu_fifo_write_n(&p_midi_host->tx_ff, staged, (uint16_t)(nstaged*4));
       // FIFO overflown, since we already check fifo remaining. It is probably race condition
-      TU_ASSERT(count == 4, i);
+      TU_ASSERT(count == nstaged*4, i);
+      nstaged = 0;
     }
   }
 
+  if (nstaged)
+  {
+    uint16_t const count = tu_fifo_write_n(&p_midi_host->tx_ff, staged, (uint16_t)(nstaged*4));
+    TU_ASSERT(count == nstaged*4, i);
+  }
+  tx_queued(dev_addr, p_midi_host);
+  MIDIH_STATS_ADD(p_midi_host, tx_refused_bytes, bufsize - i);
+
   return i;
 }
 
@@ -771,26 +2087,375 @@ bool tuh_midi_packet_write (uint8_t dev_addr, uint8_t const packet[4])
 
   if (tu_fifo_remaining(&p_midi_host->tx_ff) < 4)
   {
+    MIDIH_STATS_ADD(p_midi_host, tx_refused_packets, 1);
     return false;
   }
 
   tu_fifo_write_n(&p_midi_host->tx_ff, packet, 4);
+  tx_queued(dev_addr, p_midi_host);
 
   return true;
 }
 
+bool tuh_midi_packet_write_priority (uint8_t dev_addr, uint8_t const packet[4])
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  if (write_rt_packet(p_midi_host, packet))
+  {
+    tx_queued(dev_addr, p_midi_host);
+    return true;
+  }
+  // no room in the real-time queue, but at least do not hold the packet back
+  tx_hold_expire(p_midi_host);
+  return tuh_midi_packet_write(dev_addr, packet);
+}
+
+uint32_t tuh_midi_packet_write_n (uint8_t dev_addr, uint8_t const* packets, uint32_t num_packets)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+
+  uint32_t const available = tu_fifo_remaining(&p_midi_host->tx_ff) / 4;
+  if (num_packets > available)
+  {
+    MIDIH_STATS_ADD(p_midi_host, tx_refused_packets, num_packets - available);
+    num_packets = available;
+  }
+  if (num_packets == 0)
+  {
+    return 0;
+  }
+
+  uint32_t const written = tu_fifo_write_n(&p_midi_host->tx_ff, packets, (uint16_t)(num_packets * 4)) / 4;
+  tx_queued(dev_addr, p_midi_host);
+  return written;
+}
+
+uint32_t tuh_midi_packet_write_available (uint8_t dev_addr)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  return tu_fifo_remaining(&p_midi_host->tx_ff) / 4;
+}
+
 uint32_t tuh_midi_stream_flush( uint8_t dev_addr )
 {
   midih_interface_t *p_midi_host = get_midi_host(dev_addr);
   TU_VERIFY(p_midi_host != NULL);
 
-  uint32_t bytes_flushed = 0;
-  if (!usbh_edpt_busy(p_midi_host->dev_addr, p_midi_host->ep_out))
+  tx_sched_service(p_midi_host);
+  // If the OUT endpoint is busy, this only packs the next transfer
+  return write_flush(dev_addr, p_midi_host);
+}
+
+// Send the scheduled packets that are due and the packets a flush held
+// back once their hold time is up. midih_xfer_cb() calls this for every
+// IN transfer and tuh_midi_task() from the application's main loop, so
+// the packets do not wait for the application to flush.
+static void tx_service(uint8_t dev_addr, midih_interface_t* midi)
+{
+  bool const due = tx_sched_service(midi);
+  if (due || (midi->tx_flush_held && !tx_hold(midi)))
+  {
+    midi->tx_flush_held = false;
+    write_flush(dev_addr, midi);
+  }
+}
+
+void tuh_midi_task(void)
+{
+  for (uint8_t dev_addr = 1; dev_addr <= CFG_TUH_DEVICE_MAX; dev_addr++)
+  {
+    midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+    if (p_midi_host->configured)
+    {
+      tx_service(dev_addr, p_midi_host);
+    }
+  }
+}
+
+#if CFG_MIDI_HOST_TX_COALESCING
+bool tuh_midi_set_tx_coalescing(uint8_t dev_addr, uint32_t max_hold_us)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  TU_VERIFY(p_midi_host->configured);
+  p_midi_host->tx_hold_us = max_hold_us;
+  // anything already queued counts as queued now
+  p_midi_host->tx_holding = tx_fifo_count(p_midi_host) != 0;
+  p_midi_host->tx_hold_start = CFG_TUH_MIDI_TIME_US();
+  return true;
+}
+#endif
+
+#if CFG_MIDI_HOST_SYSEX_SEND
+bool tuh_midi_sysex_send(uint8_t dev_addr, uint8_t cable_num, uint8_t const* buffer, uint32_t len, tuh_midi_sysex_done_cb_t done_cb)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL && p_midi_host->configured);
+  TU_VERIFY(cable_num < p_midi_host->num_cables_tx);
+  TU_VERIFY(buffer != NULL && len >= 2);
+  TU_VERIFY(buffer[0] == MIDI_STATUS_SYSEX_START && buffer[len-1] == MIDI_STATUS_SYSEX_END);
+  for (uint32_t idx = 1; idx < len - 1; idx++)
+  {
+    // a status byte in the middle would end the message on the wire
+    TU_VERIFY(buffer[idx] <= MIDI_MAX_DATA_VAL);
+  }
+  TU_VERIFY(p_midi_host->sysex_buf == NULL);
+  p_midi_host->sysex_buf = buffer;
+  p_midi_host->sysex_len = len;
+  p_midi_host->sysex_pos = 0;
+  p_midi_host->sysex_ahead = tu_fifo_count(&p_midi_host->tx_ff);
+  p_midi_host->sysex_cable = cable_num;
+  p_midi_host->sysex_done_cb = done_cb;
+  // midih_xfer_cb() keeps it going from here
+  write_flush(dev_addr, p_midi_host);
+  return true;
+}
+
+bool tuh_midi_sysex_busy(uint8_t dev_addr)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  return p_midi_host->sysex_buf != NULL;
+}
+#endif
+
+bool tuh_midi_set_auto_flush(uint8_t dev_addr, bool enable)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  TU_VERIFY(p_midi_host->configured);
+  p_midi_host->auto_flush = enable;
+  if (enable)
+  {
+    // send anything queued before auto-flush was turned on
+    write_flush(dev_addr, p_midi_host);
+  }
+  return true;
+}
+
+#if MIDI_HOST_HAS_CLOCK
+uint32_t tuh_midi_time_us(void)
+{
+  return CFG_TUH_MIDI_TIME_US();
+}
+#endif
+
+bool tuh_midi_set_rx_overflow(uint8_t dev_addr, tuh_midi_rx_overflow_t policy)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL && p_midi_host->configured);
+  TU_VERIFY(policy <= TUH_MIDI_RX_DROP_SYSEX);
+  bool const tracking = rx_route_on(p_midi_host);
+  p_midi_host->rx_overflow = policy;
+  if (!tracking)
+  {
+    // nothing followed the SysEx state until now
+    p_midi_host->rx_sysex_active = 0;
+  }
+  // a message already partly queued under the old policy is not tracked
+  p_midi_host->rx_sysex_dropping = 0;
+  return true;
+}
+
+bool tuh_midi_set_rx_flow_control(uint8_t dev_addr, bool enable, uint16_t resume_level)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL && p_midi_host->configured);
+  return rx_flow_control(p_midi_host, enable, resume_level);
+}
+
+bool tuh_midi_rx_paused(uint8_t dev_addr)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  return p_midi_host->rx_paused;
+}
+
+#if CFG_MIDI_HOST_RX_FILTER
+bool tuh_midi_set_rx_filter(uint8_t dev_addr, uint8_t cable_num, uint32_t drop_types, uint16_t drop_channels)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL && p_midi_host->configured);
+  uint8_t const ncables = TU_MIN(midih_limits.max_cables, CFG_TUH_MAX_CABLES);
+  TU_VERIFY(cable_num < ncables || cable_num == TUH_MIDI_ALL_CABLES);
+  bool const tracking = rx_route_on(p_midi_host);
+  bool filter_on = false;
+  for (uint8_t cable = 0; cable < ncables; cable++)
+  {
+    if (cable_num == cable || cable_num == TUH_MIDI_ALL_CABLES)
+    {
+      p_midi_host->rx_filter_types[cable] = drop_types;
+      p_midi_host->rx_filter_channels[cable] = drop_channels;
+    }
+    filter_on = filter_on || p_midi_host->rx_filter_types[cable] || p_midi_host->rx_filter_channels[cable];
+  }
+  p_midi_host->rx_filter_on = filter_on;
+  if (!tracking)
+  {
+    // nothing followed the SysEx state until now
+    p_midi_host->rx_sysex_active = 0;
+    p_midi_host->rx_filter_sysex = 0;
+  }
+  return true;
+}
+#endif
+
+#if CFG_MIDI_HOST_TRACE
+uint32_t tuh_midi_trace_read(tuh_midi_trace_record_t* p_records, uint32_t max_records)
+{
+  TU_VERIFY(p_records != NULL, 0);
+  uint32_t nread = 0;
+  uint32_t const nlost = midih_trace_ring.head - midih_trace_ring.tail;
+  if (nlost > CFG_TUH_MIDI_TRACE_DEPTH)
+  {
+    if (max_records == 0)
+      return 0;
+    midih_trace_ring.tail = midih_trace_ring.head - CFG_TUH_MIDI_TRACE_DEPTH;
+    // stamp the gap with the time of the oldest record left so the
+    // timeline stays in order
+    uint32_t const ngap = nlost - CFG_TUH_MIDI_TRACE_DEPTH;
+    p_records[nread].time_us = midih_trace_ring.records[midih_trace_ring.tail & (CFG_TUH_MIDI_TRACE_DEPTH - 1)].time_us;
+    p_records[nread].event = TUH_MIDI_TRACE_LOST;
+    p_records[nread].dev_addr = 0;
+    p_records[nread].arg = ngap > UINT16_MAX ? UINT16_MAX : (uint16_t)ngap;
+    ++nread;
+  }
+  while (nread < max_records && midih_trace_ring.tail != midih_trace_ring.head)
+  {
+    p_records[nread++] = midih_trace_ring.records[midih_trace_ring.tail & (CFG_TUH_MIDI_TRACE_DEPTH - 1)];
+    ++midih_trace_ring.tail;
+  }
+  return nread;
+}
+
+void tuh_midi_trace_clear(void)
+{
+  midih_trace_ring.tail = midih_trace_ring.head;
+}
+#endif
+
+#if CFG_MIDI_HOST_STATS
+bool tuh_midi_get_stats(uint8_t dev_addr, tuh_midi_stats_t* p_stats)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  TU_ASSERT(p_stats);
+  *p_stats = p_midi_host->stats;
+  return true;
+}
+
+bool tuh_midi_reset_stats(uint8_t dev_addr)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  tu_memclr(&p_midi_host->stats, sizeof(p_midi_host->stats));
+  return true;
+}
+#endif
+
+#if CFG_MIDI_HOST_TX_SCHEDULE
+// Return true if event a is due before event b. Due times are compared
+// as a signed difference so the clock can wrap.
+static bool sched_before(midih_sched_event_t const* a, midih_sched_event_t const* b)
+{
+  int32_t const diff = (int32_t)(a->due_us - b->due_us);
+  return diff < 0 || (diff == 0 && (int32_t)(a->seq - b->seq) < 0);
+}
+
+static void sched_swap(midih_sched_event_t* a, midih_sched_event_t* b)
+{
+  midih_sched_event_t const tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+// Remove tx_sched[0] and restore the heap order
+static void sched_pop(midih_interface_t* midi)
+{
+  midih_sched_event_t* heap = midi->tx_sched;
+  uint16_t const count = --midi->tx_sched_count;
+  heap[0] = heap[count];
+  uint16_t parent = 0;
+  for (;;)
+  {
+    uint16_t first = parent;
+    uint16_t const left = (uint16_t)(2*parent + 1);
+    uint16_t const right = (uint16_t)(left + 1);
+    if (left < count && sched_before(&heap[left], &heap[first]))
+      first = left;
+    if (right < count && sched_before(&heap[right], &heap[first]))
+      first = right;
+    if (first == parent)
+      break;
+    sched_swap(&heap[parent], &heap[first]);
+    parent = first;
+  }
+}
+#endif
+
+// Move the scheduled packets that are due to tx_ff and make sure the
+// coalescing policy does not hold them back. Return true if any moved.
+static bool tx_sched_service(midih_interface_t* midi)
+{
+#if CFG_MIDI_HOST_TX_SCHEDULE
+  if (midi->tx_sched_count == 0)
+    return false;
+  uint32_t const now = CFG_TUH_MIDI_TIME_US();
+  bool moved = false;
+  while (midi->tx_sched_count && (int32_t)(midi->tx_sched[0].due_us - now) <= 0 &&
+         tu_fifo_remaining(&midi->tx_ff) >= 4)
   {
-    bytes_flushed = write_flush(dev_addr, p_midi_host);
+    tu_fifo_write_n(&midi->tx_ff, midi->tx_sched[0].packet, 4);
+    sched_pop(midi);
+    moved = true;
   }
-  return bytes_flushed;
+  if (moved)
+  {
+    tx_hold_expire(midi);
+  }
+  return moved;
+#else
+  (void) midi;
+  return false;
+#endif
 }
+
+#if CFG_MIDI_HOST_TX_SCHEDULE
+bool tuh_midi_packet_write_at(uint8_t dev_addr, uint8_t const packet[4], uint32_t due_us)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  TU_VERIFY(p_midi_host->tx_sched != NULL);
+  TU_VERIFY(p_midi_host->tx_sched_count < CFG_TUH_MIDI_TX_SCHED_DEPTH);
+
+  // add the packet at the bottom of the heap and sift it up
+  midih_sched_event_t* heap = p_midi_host->tx_sched;
+  uint16_t child = p_midi_host->tx_sched_count++;
+  heap[child].due_us = due_us;
+  heap[child].seq = p_midi_host->tx_sched_seq++;
+  memcpy(heap[child].packet, packet, 4);
+  while (child > 0)
+  {
+    uint16_t const parent = (uint16_t)((child - 1) / 2);
+    if (!sched_before(&heap[child], &heap[parent]))
+      break;
+    sched_swap(&heap[child], &heap[parent]);
+    child = parent;
+  }
+  return true;
+}
+
+uint32_t tuh_midi_packet_write_at_available(uint8_t dev_addr)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  TU_VERIFY(p_midi_host->tx_sched != NULL);
+  return CFG_TUH_MIDI_TX_SCHED_DEPTH - p_midi_host->tx_sched_count;
+}
+#endif
 //--------------------------------------------------------------------+
 // Helper
 //--------------------------------------------------------------------+
@@ -814,130 +2479,310 @@ bool tuh_midi_packet_read (uint8_t dev_addr, uint8_t packet[4])
 {
   midih_interface_t *p_midi_host = get_midi_host(dev_addr);
   TU_VERIFY(p_midi_host != NULL);
-  TU_VERIFY(tu_fifo_count(&p_midi_host->rx_ff) >= 4);
-  return tu_fifo_read_n(&p_midi_host->rx_ff, packet, 4) == 4;
+  tu_fifo_t *rx_ff = get_rx_fifo(p_midi_host);
+  TU_VERIFY(tu_fifo_count(rx_ff) >= 4);
+  bool const success = tu_fifo_read_n(rx_ff, packet, 4) == 4;
+  rx_flow_resume(p_midi_host);
+  return success;
 }
 
-uint32_t tuh_midi_stream_read (uint8_t dev_addr, uint8_t *p_cable_num, uint8_t *p_buffer, uint16_t bufsize)
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+bool tuh_midi_packet_read_ts (uint8_t dev_addr, uint8_t packet[4], uint32_t *p_timestamp)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  TU_ASSERT(p_timestamp);
+  tu_fifo_t *rx_ff = get_rx_fifo(p_midi_host);
+  tu_fifo_buffer_info_t info;
+  tu_fifo_get_read_info(rx_ff, &info);
+  TU_VERIFY(info.len_lin >= 4);
+  *p_timestamp = *rx_ts_slot(p_midi_host, info.ptr_lin);
+  bool const success = tu_fifo_read_n(rx_ff, packet, 4) == 4;
+  rx_flow_resume(p_midi_host);
+  return success;
+}
+#endif
+
+uint32_t tuh_midi_packet_read_n (uint8_t dev_addr, uint8_t* packets, uint32_t max_packets)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  uint32_t nread = 0;
+  while (nread < max_packets)
+  {
+    tu_fifo_t *rx_ff = get_rx_fifo(p_midi_host);
+    uint32_t npackets = tu_fifo_count(rx_ff) / 4;
+    if (npackets > max_packets - nread)
+      npackets = max_packets - nread;
+    if (npackets == 0)
+      break;
+    nread += tu_fifo_read_n(rx_ff, packets + nread * 4, (uint16_t)(npackets * 4)) / 4;
+  }
+  rx_flow_resume(p_midi_host);
+  return nread;
+}
+
+uint32_t tuh_midi_packet_peek (uint8_t dev_addr, uint8_t const** p_packets)
 {
   midih_interface_t *p_midi_host = get_midi_host(dev_addr);
   TU_VERIFY(p_midi_host != NULL);
+  TU_ASSERT(p_packets);
+  tu_fifo_t *rx_ff = get_rx_fifo(p_midi_host);
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  p_midi_host->rx_peek_ff = rx_ff;
+#endif
+  tu_fifo_buffer_info_t info;
+  tu_fifo_get_read_info(rx_ff, &info);
+  // the FIFO depth is a multiple of 4, so the linear part always holds whole packets
+  *p_packets = (uint8_t const*)info.ptr_lin;
+  return info.len_lin / 4;
+}
+
+void tuh_midi_packet_consume (uint8_t dev_addr, uint32_t num_packets)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  if (p_midi_host == NULL)
+    return;
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+  tu_fifo_t *rx_ff = p_midi_host->rx_peek_ff;
+#else
+  tu_fifo_t *rx_ff = &p_midi_host->rx_ff;
+#endif
+  uint32_t const npackets = tu_fifo_count(rx_ff) / 4;
+  if (num_packets > npackets)
+    num_packets = npackets;
+  tu_fifo_advance_read_pointer(rx_ff, (uint16_t)(num_packets * 4));
+  rx_flow_resume(p_midi_host);
+}
+
+// Return the number of MIDI 1.0 byte stream bytes that start at packet[1]
+// for the USB MIDI packet and update the cable's bit in *p_sysex_in_progress.
+// This function ignores the CIN field of the MIDI packet because too many
+// devices out there encode it wrong.
+static uint8_t midi_packet_stream_bytes(uint8_t const* packet, uint16_t* p_sysex_in_progress)
+{
+  uint16_t const cable_mask = (uint16_t) (1 << (packet[0] >> 4));
+  uint8_t const status = packet[1];
+  uint8_t nbytes = 0;
+  if (status <= MIDI_MAX_DATA_VAL || status == MIDI_STATUS_SYSEX_START)
+  {
+    if (status == MIDI_STATUS_SYSEX_START)
+    {
+      *p_sysex_in_progress |= cable_mask;
+    }
+    // only add the packet if a sysex message is in progress
+    if (*p_sysex_in_progress & cable_mask)
+    {
+      // packet[1] plus the data bytes after it up to and including SysEx End
+      for (nbytes = 1; nbytes < 3 && packet[nbytes+1] <= MIDI_MAX_DATA_VAL; nbytes++) {}
+      if (nbytes < 3 && packet[nbytes+1] == MIDI_STATUS_SYSEX_END)
+      {
+        ++nbytes;
+        *p_sysex_in_progress &= (uint16_t) ~cable_mask;
+      }
+    }
+  }
+  else if (status < MIDI_STATUS_SYSEX_START)
+  {
+    // then it is a channel message either three bytes or two
+    nbytes = MIDI_STATUS_INFO_TOTAL(midi_channel_status_info[(status >> 4) - MIDI_CIN_NOTE_OFF]) - 1;
+    *p_sysex_in_progress &= (uint16_t) ~cable_mask;
+  }
+  else if (status < MIDI_STATUS_SYSREAL_TIMING_CLOCK)
+  {
+    // System Common message, including a SysEx End on its own
+    nbytes = MIDI_STATUS_INFO_TOTAL(midi_system_status_info[status & 0x07]) - 1;
+    *p_sysex_in_progress &= (uint16_t) ~cable_mask;
+  }
+  else
+  {
+    // Real-time message: can be inserted into a sysex message,
+    // so do don't clear cable_sysex_in_progress bit
+    nbytes = 1;
+  }
+  return nbytes;
+}
+
+// Decode MIDI packets for a single cable from rx_ff into the MIDI 1.0 byte
+// stream; see tuh_midi_stream_read(). If p_timestamp is not NULL, also stop
+// at a packet that arrived at a different time than the first one and
+// store the first one's arrival time there.
+static uint32_t stream_read_fifo(midih_interface_t *p_midi_host, tu_fifo_t *rx_ff, uint8_t *p_cable_num, uint8_t *p_buffer, uint16_t bufsize, uint32_t *p_timestamp)
+{
   uint32_t bytes_buffered = 0;
-  TU_ASSERT(p_cable_num);
-  TU_ASSERT(p_buffer);
-  TU_ASSERT(bufsize);
-  uint8_t one_byte;
-  if (!tu_fifo_peek(&p_midi_host->rx_ff, &one_byte))
+
+  // Decode the packets in place in the RX FIFO. Its depth is a multiple of 4,
+  // so the linear and wrapped parts of the FIFO each hold whole packets.
+  tu_fifo_buffer_info_t info;
+  tu_fifo_get_read_info(rx_ff, &info);
+  uint8_t const* packet = (uint8_t const*)info.ptr_lin;
+  uint32_t npackets = info.len_lin / 4;
+  if (npackets == 0)
   {
     return 0;
   }
-  *p_cable_num = (one_byte >> 4) & 0xf;
-  uint32_t nread = tu_fifo_read_n(&p_midi_host->rx_ff, p_midi_host->stream_read.buffer, 4);
-  static uint16_t cable_sysex_in_progress; // bit i is set if received MIDI_STATUS_SYSEX_START but not MIDI_STATUS_SYSEX_END
-  while (nread == 4 && bytes_buffered < bufsize)
+  uint8_t const cable_num = (packet[0] >> 4) & 0xf;
+  *p_cable_num = cable_num;
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+  uint32_t const timestamp = *rx_ts_slot(p_midi_host, packet);
+  if (p_timestamp)
   {
-    *p_cable_num=(p_midi_host->stream_read.buffer[0] >> 4) & 0x0f;
-    uint8_t bytes_to_add_to_stream = 0;
-    if (*p_cable_num < p_midi_host->num_cables_rx)
+    *p_timestamp = timestamp;
+  }
+#else
+  (void) p_timestamp;
+#endif
+
+  bool done = false;
+  while (!done)
+  {
+    uint32_t nconsumed = 0;
+    for (; nconsumed < npackets; nconsumed++, packet += 4)
     {
-      // ignore the CIN field; too many devices out there encode this wrong
-      uint8_t status = p_midi_host->stream_read.buffer[1];
-      uint16_t cable_mask = (uint16_t) (1 << *p_cable_num);
-      if (status <= MIDI_MAX_DATA_VAL || status == MIDI_STATUS_SYSEX_START)
+      // stop at a packet for a different cable
+      if ((packet[0] >> 4) != cable_num)
       {
-        if (status == MIDI_STATUS_SYSEX_START)
-        {
-          cable_sysex_in_progress |= cable_mask;
-        }
-        // only add the packet if a sysex message is in progress
-        if (cable_sysex_in_progress & cable_mask)
-        {
-          ++bytes_to_add_to_stream;
-          uint8_t idx;
-          for (idx = 2; idx < 4; idx++)
-          {
-            if (p_midi_host->stream_read.buffer[idx] <= MIDI_MAX_DATA_VAL)
-            {
-              ++bytes_to_add_to_stream;
-            }
-            else if (p_midi_host->stream_read.buffer[idx] == MIDI_STATUS_SYSEX_END)
-            {
-              ++bytes_to_add_to_stream;
-              cable_sysex_in_progress &= (uint16_t) ~cable_mask;
-              idx = 4; // force the loop to exit; I hate break statements in loops
-            }
-          }
-        }
+        done = true;
+        break;
       }
-      else if (status < MIDI_STATUS_SYSEX_START)
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+      if (p_timestamp && *rx_ts_slot(p_midi_host, packet) != timestamp)
       {
-        // then it is a channel message either three bytes or two
-        uint8_t fake_cin = (status & 0xf0) >> 4;
-        switch (fake_cin)
-        {
-          case MIDI_CIN_NOTE_OFF:
-          case MIDI_CIN_NOTE_ON:
-          case MIDI_CIN_POLY_KEYPRESS:
-          case MIDI_CIN_CONTROL_CHANGE:
-          case MIDI_CIN_PITCH_BEND_CHANGE:
-            bytes_to_add_to_stream = 3;
-            break;
-          case MIDI_CIN_PROGRAM_CHANGE:
-          case MIDI_CIN_CHANNEL_PRESSURE:
-            bytes_to_add_to_stream = 2;
-            break;
-          default:
-            break; // Should not get this
-        }
-        cable_sysex_in_progress &= (uint16_t)~cable_mask;
+        done = true;
+        break;
       }
-      else if (status < MIDI_STATUS_SYSREAL_TIMING_CLOCK)
+#endif
+      uint8_t nbytes = 0;
+      uint16_t sysex_in_progress = p_midi_host->cable_sysex_in_progress;
+      if (cable_num < p_midi_host->num_cables_rx)
       {
-        switch (status)
-        {
-          case MIDI_STATUS_SYSCOM_TIME_CODE_QUARTER_FRAME:
-          case MIDI_STATUS_SYSCOM_SONG_SELECT:
-            bytes_to_add_to_stream = 2;
-            break;
-          case MIDI_STATUS_SYSCOM_SONG_POSITION_POINTER:
-            bytes_to_add_to_stream = 3;
-            break;
-          case MIDI_STATUS_SYSCOM_TUNE_REQUEST:
-          case MIDI_STATUS_SYSEX_END:
-            bytes_to_add_to_stream = 1;
-            break;
-          default:
-            break;
-          cable_sysex_in_progress &= (uint16_t)~cable_mask;
-        }
+        nbytes = midi_packet_stream_bytes(packet, &sysex_in_progress);
       }
-      else
+      // never split a message across calls; leave the packet for next time
+      if (bytes_buffered + nbytes > bufsize)
       {
-        // Real-time message: can be inserted into a sysex message,
-        // so do don't clear cable_sysex_in_progress bit
-        bytes_to_add_to_stream = 1;
+        done = true;
+        break;
       }
+      p_midi_host->cable_sysex_in_progress = sysex_in_progress;
+      memcpy(p_buffer + bytes_buffered, packet + 1, nbytes);
+      bytes_buffered += nbytes;
     }
-    uint8_t idx;
-    for (idx = 1; idx <= bytes_to_add_to_stream; idx++)
+    tu_fifo_advance_read_pointer(rx_ff, (uint16_t)(nconsumed * 4));
+    if (!done)
     {
-      *p_buffer++ = p_midi_host->stream_read.buffer[idx];
+      // continue with the wrapped part of the FIFO, if any
+      tu_fifo_get_read_info(rx_ff, &info);
+      packet = (uint8_t const*)info.ptr_lin;
+      npackets = info.len_lin / 4;
+      done = (npackets == 0);
     }
-    bytes_buffered += bytes_to_add_to_stream;
-    nread = 0;
-    if (tu_fifo_peek(&p_midi_host->rx_ff, &one_byte))
+  }
+  rx_flow_resume(p_midi_host);
+
+  return bytes_buffered;
+}
+
+// Decode one USB MIDI packet into *p_event. Like tuh_midi_stream_read(),
+// go by the status byte, not the CIN, and follow the cable's SysEx state
+// in cable_sysex_in_progress so the two can read the same RX FIFO in turn.
+// Return false if the packet is not a whole message, such as part of a
+// SysEx message.
+static bool decode_event(midih_interface_t *p_midi_host, uint8_t const* packet, tuh_midi_event_t *p_event)
+{
+  uint8_t const cable_num = packet[0] >> 4;
+  uint8_t const status = packet[1];
+  if (cable_num >= p_midi_host->num_cables_rx)
+  {
+    return false;
+  }
+  (void) midi_packet_stream_bytes(packet, &p_midi_host->cable_sysex_in_progress);
+  if (status < 0x80 || status == MIDI_STATUS_SYSEX_START || status == MIDI_STATUS_SYSEX_END)
+  {
+    return false;
+  }
+  p_event->cable_num = cable_num;
+  if (status < 0xF0)
+  {
+    p_event->type = status & 0xF0;
+    p_event->channel = status & 0x0F;
+  }
+  else
+  {
+    p_event->type = status;
+    p_event->channel = 0;
+  }
+  p_event->data1 = packet[2];
+  p_event->data2 = packet[3];
+  p_event->value = (uint16_t)((packet[2] & 0x7f) | ((packet[3] & 0x7f) << 7));
+  return true;
+}
+
+uint32_t tuh_midi_event_read(uint8_t dev_addr, tuh_midi_event_t* events, uint32_t max_events)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  TU_ASSERT(events);
+  uint32_t nevents = 0;
+  while (nevents < max_events)
+  {
+    // decode the packets in place in the RX FIFO, like stream_read_fifo()
+    tu_fifo_t *rx_ff = get_rx_fifo(p_midi_host);
+    tu_fifo_buffer_info_t info;
+    tu_fifo_get_read_info(rx_ff, &info);
+    uint32_t const npackets = info.len_lin / 4;
+    if (npackets == 0)
+      break;
+    uint8_t const* packet = (uint8_t const*)info.ptr_lin;
+    uint32_t nconsumed = 0;
+    for (; nconsumed < npackets && nevents < max_events; nconsumed++, packet += 4)
     {
-      uint8_t new_cable = (one_byte >> 4) & 0xf;
-      if (new_cable == *p_cable_num)
+      if (decode_event(p_midi_host, packet, &events[nevents]))
       {
-        // still on the same cable. Continue reading the stream
-        nread = tu_fifo_read_n(&p_midi_host->rx_ff, p_midi_host->stream_read.buffer, 4);
+        ++nevents;
       }
     }
+    tu_fifo_advance_read_pointer(rx_ff, (uint16_t)(nconsumed * 4));
   }
+  rx_flow_resume(p_midi_host);
+  return nevents;
+}
 
-  return bytes_buffered;
+uint32_t tuh_midi_stream_read (uint8_t dev_addr, uint8_t *p_cable_num, uint8_t *p_buffer, uint16_t bufsize)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  TU_ASSERT(p_cable_num);
+  TU_ASSERT(p_buffer);
+  TU_VERIFY(bufsize >= 3, 0); // or a 3 byte message could never be read
+  return stream_read_fifo(p_midi_host, get_rx_fifo(p_midi_host), p_cable_num, p_buffer, bufsize, NULL);
+}
+
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+uint32_t tuh_midi_stream_read_ts (uint8_t dev_addr, uint8_t *p_cable_num, uint8_t *p_buffer, uint16_t bufsize, uint32_t *p_timestamp)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  TU_ASSERT(p_cable_num);
+  TU_ASSERT(p_buffer);
+  TU_VERIFY(bufsize >= 3, 0);
+  TU_ASSERT(p_timestamp);
+  return stream_read_fifo(p_midi_host, get_rx_fifo(p_midi_host), p_cable_num, p_buffer, bufsize, p_timestamp);
 }
+#endif
+
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+uint32_t tuh_midi_stream_read_cable (uint8_t dev_addr, uint8_t cable_num, uint8_t *p_buffer, uint16_t bufsize)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  TU_VERIFY(cable_num < midih_limits.max_cables);
+  TU_ASSERT(p_buffer);
+  TU_VERIFY(bufsize >= 3, 0);
+  uint8_t cable;
+  return stream_read_fifo(p_midi_host, &p_midi_host->rx_cable_ff[cable_num], &cable, p_buffer, bufsize, NULL);
+}
+#endif
 
 uint8_t tuh_midi_get_num_rx_cables(uint8_t dev_addr)
 {
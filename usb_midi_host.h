@@ -54,7 +54,8 @@
 // from the device. This has to be at least equal to the maximum bulk
 // transfer size of 64 bytes, but it is a good idea to set this to
 // at least the maximum SysEx message size in MIDI packets to improve
-// throughput.
+// throughput. It is rounded down to a multiple of 4 bytes so
+// MIDI packets never wrap around the end of the buffer.
 //
 // midi_tx_buffer_bytes is the maximum number of bytes the application
 // can write out to the interface in a single transaction. This should
@@ -74,6 +75,24 @@
 //
 void tuh_midih_define_limits(size_t midi_rx_buffer_bytes, size_t midi_tx_buffer_bytes, uint8_t max_cables);
 
+// Set CFG_MIDI_HOST_STATIC_ALLOC to 1 to take the driver's buffers from
+// statically allocated arrays instead of the heap. The arrays are sized
+// from CFG_TUH_MIDI_RX_BUFSIZE, CFG_TUH_MIDI_TX_BUFSIZE and
+// CFG_TUH_MAX_CABLES for each of the CFG_TUH_MIDI_DEVICE_MAX buffer sets,
+// so the linker accounts for all of the RAM the driver uses. In this mode,
+// tuh_midih_define_limits() can only lower those sizes.
+#ifndef CFG_MIDI_HOST_STATIC_ALLOC
+#define CFG_MIDI_HOST_STATIC_ALLOC 0
+#endif
+
+#if !CFG_MIDI_HOST_STATIC_ALLOC
+// Use alloc_fn and free_fn instead of malloc() and free() for the
+// driver's buffers, for example to carve them out of an application
+// arena. Pass NULL to go back to malloc() and free(). Like
+// tuh_midih_define_limits(), call this before midih_init() gets called.
+void tuh_midih_set_allocator(void* (*alloc_fn)(size_t size), void (*free_fn)(void* ptr));
+#endif
+
 #ifndef CFG_MIDI_HOST_DEVSTRINGS
 #ifdef ARDUINO
 #define CFG_MIDI_HOST_DEVSTRINGS 1
@@ -82,6 +101,108 @@ void tuh_midih_define_limits(size_t midi_rx_buffer_bytes, size_t midi_tx_buffer_
 #endif
 #endif
 
+// Set CFG_MIDI_HOST_RX_CABLE_QUEUES to 1 to sort received packets into
+// one queue per virtual cable as they arrive. tuh_midi_stream_read() then
+// returns all queued bytes for one cable per call even if the device
+// interleaves packets for several cables, and tuh_midi_stream_read_cable()
+// reads a specific cable. The midi_rx_buffer_bytes passed to
+// tuh_midih_define_limits() (or CFG_TUH_MIDI_RX_BUFSIZE) is split evenly
+// among the max_cables queues, so size it as max_cables times the
+// buffer you want per cable. The packet read functions take packets from
+// the cable queues round robin, so the relative order of packets for
+// different cables is not preserved in this mode.
+#ifndef CFG_MIDI_HOST_RX_CABLE_QUEUES
+#define CFG_MIDI_HOST_RX_CABLE_QUEUES 0
+#endif
+
+// If the application implements tuh_midi_rt_cb(), real-time messages
+// are also queued for tuh_midi_stream_read() and tuh_midi_packet_read()
+// unless CFG_MIDI_HOST_RX_RT_FIFO is set to 0.
+#ifndef CFG_MIDI_HOST_RX_RT_FIFO
+#define CFG_MIDI_HOST_RX_RT_FIFO 1
+#endif
+
+// Set CFG_MIDI_HOST_RX_TIMESTAMPS to 1 to record when each received
+// packet arrived and read it back with tuh_midi_packet_read_ts() and
+// tuh_midi_stream_read_ts(). This takes another 4 bytes of RAM per
+// packet the RX buffer holds.
+#ifndef CFG_MIDI_HOST_RX_TIMESTAMPS
+#define CFG_MIDI_HOST_RX_TIMESTAMPS 0
+#endif
+
+// Set CFG_MIDI_HOST_AUTO_FLUSH to 1 to make auto-flush the default for
+// every MIDI device that gets mounted. See tuh_midi_set_auto_flush().
+#ifndef CFG_MIDI_HOST_AUTO_FLUSH
+#define CFG_MIDI_HOST_AUTO_FLUSH 0
+#endif
+
+// Set CFG_MIDI_HOST_STATS to 1 to count transfers, packets and errors
+// for each device; see tuh_midi_get_stats()
+#ifndef CFG_MIDI_HOST_STATS
+#define CFG_MIDI_HOST_STATS 0
+#endif
+
+// Set CFG_MIDI_HOST_TX_SCHEDULE to 1 to be able to queue packets ahead
+// of time with tuh_midi_packet_write_at()
+#ifndef CFG_MIDI_HOST_TX_SCHEDULE
+#define CFG_MIDI_HOST_TX_SCHEDULE 0
+#endif
+
+// What the driver drops for every MIDI device that gets mounted when a
+// receive FIFO is full; a tuh_midi_rx_overflow_t. See
+// tuh_midi_set_rx_overflow().
+#ifndef CFG_MIDI_HOST_RX_OVERFLOW
+#define CFG_MIDI_HOST_RX_OVERFLOW 0
+#endif
+
+// Set CFG_MIDI_HOST_RX_FLOW_CONTROL to 1 to turn on RX flow control for
+// every MIDI device that gets mounted; see tuh_midi_set_rx_flow_control()
+#ifndef CFG_MIDI_HOST_RX_FLOW_CONTROL
+#define CFG_MIDI_HOST_RX_FLOW_CONTROL 0
+#endif
+
+// Set CFG_MIDI_HOST_SYSEX_SEND to 1 to be able to send SysEx messages
+// straight from an application buffer with tuh_midi_sysex_send()
+#ifndef CFG_MIDI_HOST_SYSEX_SEND
+#define CFG_MIDI_HOST_SYSEX_SEND 0
+#endif
+
+// Set CFG_MIDI_HOST_SYSEX_RX to 1 to have the driver reassemble received
+// SysEx messages and deliver them whole; see tuh_midi_sysex_cb()
+#ifndef CFG_MIDI_HOST_SYSEX_RX
+#define CFG_MIDI_HOST_SYSEX_RX 0
+#endif
+
+// Set CFG_MIDI_HOST_RX_FILTER to 1 to be able to drop received messages
+// by cable, message type and channel before they are queued; see
+// tuh_midi_set_rx_filter()
+#ifndef CFG_MIDI_HOST_RX_FILTER
+#define CFG_MIDI_HOST_RX_FILTER 0
+#endif
+
+// Set CFG_MIDI_HOST_TRACE to 1 to record driver events in a binary trace
+// ring; see tuh_midi_trace_read()
+#ifndef CFG_MIDI_HOST_TRACE
+#define CFG_MIDI_HOST_TRACE 0
+#endif
+
+// Default TX coalescing hold time in microseconds for every MIDI device
+// that gets mounted. See tuh_midi_set_tx_coalescing().
+#ifndef CFG_MIDI_HOST_TX_HOLD_US
+#define CFG_MIDI_HOST_TX_HOLD_US 0
+#endif
+
+// Set CFG_MIDI_HOST_TX_COALESCING to 1 to be able to hold back TX data for
+// fuller USB transfers; see tuh_midi_set_tx_coalescing(). A default hold
+// time in CFG_MIDI_HOST_TX_HOLD_US turns it on.
+#ifndef CFG_MIDI_HOST_TX_COALESCING
+#define CFG_MIDI_HOST_TX_COALESCING (CFG_MIDI_HOST_TX_HOLD_US != 0)
+#endif
+
+// The features that need the driver's clock; see tuh_midi_time_us()
+#define MIDI_HOST_HAS_CLOCK (CFG_MIDI_HOST_RX_TIMESTAMPS || CFG_MIDI_HOST_TRACE || \
+                             CFG_MIDI_HOST_TX_SCHEDULE || CFG_MIDI_HOST_TX_COALESCING)
+
 //--------------------------------------------------------------------+
 // Application API (Single Interface)
 //--------------------------------------------------------------------+
@@ -103,6 +224,29 @@ uint8_t tuh_midih_get_num_rx_cables (uint8_t dev_addr);
 // Returns true if the packet was successfully queued.
 bool tuh_midi_packet_write (uint8_t dev_addr, uint8_t const packet[4]);
 
+// Same as tuh_midi_packet_write() except the packet goes in the
+// high priority queue that tuh_midi_stream_flush() sends ahead of
+// everything else. tuh_midi_stream_write() puts real-time messages
+// (0xF8-0xFF) there automatically. Use this for other time critical
+// packets, but only for whole messages: a packet sent this way can
+// overtake packets queued earlier, including the middle of a SysEx
+// message. It cannot overtake a USB transfer that is already packed
+// (see tuh_midi_stream_flush()). If the high priority queue is full, the
+// packet is queued normally. Returns true if the packet was successfully queued.
+bool tuh_midi_packet_write_priority (uint8_t dev_addr, uint8_t const packet[4]);
+
+// Queue up to num_packets 4-byte packets stored back to back in the
+// buffer pointed to by packets. The application must call
+// tuh_midi_stream_flush to actually have the data go out. Packets are
+// queued in order until the FIFO is full; a packet is never split.
+// Returns the number of packets queued. To queue all or none of
+// the packets, check tuh_midi_packet_write_available() first.
+uint32_t tuh_midi_packet_write_n (uint8_t dev_addr, uint8_t const* packets, uint32_t num_packets);
+
+// Return the number of 4-byte packets that can be queued to the
+// device right now.
+uint32_t tuh_midi_packet_write_available (uint8_t dev_addr);
+
 // Queue a message to the device. The application
 // must call tuh_midi_stream_flush to actually have the
 // data go out. Note that cable_num must be < CFG_TUH_CABLE_MAX
@@ -116,22 +260,286 @@ bool tuh_midi_can_write_stream (uint8_t dev_addr);
 // Send any queued packets to the device if the host hardware is able to do it
 // Returns the number of bytes flushed to the host hardware or 0 if
 // the host hardware is busy or there is nothing in queue to send.
+// While the host hardware is busy, this packs the next USB transfer from
+// the queue so it can go out as soon as the current one completes.
 uint32_t tuh_midi_stream_flush( uint8_t dev_addr);
 
+// Call this from the application's main loop, right after tuh_task(). It
+// sends the packets tuh_midi_packet_write_at() scheduled once they are
+// due and the packets TX coalescing held back once their hold time is up,
+// so their timing does not depend on when the application flushes or on
+// the device completing transfers. How often it runs sets the timing
+// jitter. TinyUSB gives class drivers no periodic hook of their own, so
+// without this call these packets only go out when a transfer completes
+// or the application calls tuh_midi_stream_flush().
+void tuh_midi_task(void);
+
+// Turn auto-flush on or off for the device. With auto-flush on,
+// tuh_midi_stream_write() and the tuh_midi_packet_write functions start
+// sending what they queued as soon as the OUT endpoint is free, and
+// each OUT transfer that completes starts the next one from tuh_task(),
+// so the application never needs to call tuh_midi_stream_flush().
+// Call this from tuh_midi_mount_cb() or later. With TX coalescing on
+// (see tuh_midi_set_tx_coalescing()), tuh_midi_task() sends the packets
+// held back once the hold time is up. Returns false if the device is not
+// mounted.
+bool tuh_midi_set_auto_flush(uint8_t dev_addr, bool enable);
+
+#if CFG_MIDI_HOST_SYSEX_SEND
+// tuh_midi_sysex_send() calls this when it is done with buffer. complete
+// is false if the device was unmounted before the whole message was sent.
+typedef void (*tuh_midi_sysex_done_cb_t)(uint8_t dev_addr, uint8_t const* buffer, bool complete);
+
+// Send the complete SysEx message in buffer, 0xF0 through 0xF7, on cable
+// cable_num without copying it to the TX FIFO. The driver packs the
+// message into USB MIDI packets straight from buffer as each OUT transfer
+// completes, so the buffer must stay valid and unchanged until done_cb
+// (which may be NULL) is called. Packets queued before this call go out
+// first. Real-time packets queued with tuh_midi_packet_write_priority()
+// are sent in the middle of the message, but other packets queued while
+// it is being sent wait until the message ends. Returns false if the
+// device is not mounted, another message is still being sent or the
+// message is not valid: it must start with 0xF0, end with 0xF7 and hold
+// only data bytes (0x00-0x7F) in between.
+bool tuh_midi_sysex_send(uint8_t dev_addr, uint8_t cable_num, uint8_t const* buffer, uint32_t len, tuh_midi_sysex_done_cb_t done_cb);
+
+// Return true if tuh_midi_sysex_send() is still sending a message
+bool tuh_midi_sysex_busy(uint8_t dev_addr);
+#endif
+
+#if CFG_MIDI_HOST_TX_COALESCING
+// Trade up to max_hold_us microseconds of latency for fuller USB transfers.
+// Flushing holds back queued packets until a full OUT endpoint's worth
+// is queued or the oldest held packet has been queued for max_hold_us
+// (1000 us is one full speed USB frame). Packets in the real-time queue
+// (see tuh_midi_packet_write_priority()) are never held. This works with
+// and without auto-flush: tuh_midi_task(), tuh_midi_stream_flush() and
+// transfer completions send the held packets once the hold time is up, so
+// call tuh_midi_task() from the main loop. 0 (the default unless
+// CFG_MIDI_HOST_TX_HOLD_US says otherwise) sends without holding.
+// Returns false if the device is not mounted.
+bool tuh_midi_set_tx_coalescing(uint8_t dev_addr, uint32_t max_hold_us);
+#endif
+
+#if MIDI_HOST_HAS_CLOCK
+// Return the driver's free running microsecond clock (CFG_TUH_MIDI_TIME_US()).
+// Timestamps, the trace, due times and hold times use this clock. It wraps
+// about every 71 minutes. On the RP2040 it is time_us_32(). On other MCUs,
+// unless tusb_config.h defines CFG_TUH_MIDI_TIME_US(), it is made from
+// tusb_time_millis_api() and only has 1 ms resolution: it counts in steps
+// of 1000.
+uint32_t tuh_midi_time_us(void);
+#endif
+
+// What to drop when a packet arrives and the receive FIFO is full.
+// Whole 4-byte packets are always dropped, never parts of one.
+typedef enum
+{
+  TUH_MIDI_RX_DROP_NEWEST = 0, // drop the packets that do not fit (the default)
+  TUH_MIDI_RX_DROP_OLDEST,     // discard the oldest queued packets to make room
+  TUH_MIDI_RX_DROP_SYSEX,      // drop the newest messages; once a SysEx message
+                               // loses a packet, drop the rest of it too
+} tuh_midi_rx_overflow_t;
+
+// Choose what the driver drops when the device's receive FIFO is full.
+// TUH_MIDI_RX_DROP_SYSEX leaves a SysEx message that lost data without its
+// 0xF7 end byte so the application can tell it is incomplete. With
+// TUH_MIDI_RX_DROP_OLDEST, do not run tuh_task() between
+// tuh_midi_packet_peek() and tuh_midi_packet_consume(). Returns false if
+// the device is not mounted or the policy is not valid.
+bool tuh_midi_set_rx_overflow(uint8_t dev_addr, tuh_midi_rx_overflow_t policy);
+
+// With RX flow control on, the driver stops polling the IN endpoint when
+// an RX FIFO might not have room for the next transfer. The device NAKs
+// and holds its data until the application reads the FIFO(s) down to
+// resume_level bytes; then polling restarts. CFG_MIDI_HOST_RX_FLOW_CONTROL
+// uses half of an RX FIFO. Nothing is dropped, but a device that cannot hold its data
+// may lose it. Returns false if the device is not mounted or an RX FIFO
+// cannot hold two IN transfers.
+bool tuh_midi_set_rx_flow_control(uint8_t dev_addr, bool enable, uint16_t resume_level);
+
+// Return true if RX flow control stopped polling the IN endpoint
+bool tuh_midi_rx_paused(uint8_t dev_addr);
+
+#if CFG_MIDI_HOST_RX_FILTER
+// Message type bits for tuh_midi_set_rx_filter(). Channel messages use
+// bits 0-6 and system messages bits 16-31, one for each status byte.
+#define TUH_MIDI_FILTER_STATUS(status)    ((status) < 0xF0 ? 1ul << (((status) >> 4) - 8) : 1ul << (16 + ((status) & 0x0F)))
+#define TUH_MIDI_FILTER_NOTE_OFF          TUH_MIDI_FILTER_STATUS(0x80)
+#define TUH_MIDI_FILTER_NOTE_ON           TUH_MIDI_FILTER_STATUS(0x90)
+#define TUH_MIDI_FILTER_POLY_KEYPRESS     TUH_MIDI_FILTER_STATUS(0xA0)
+#define TUH_MIDI_FILTER_CONTROL_CHANGE    TUH_MIDI_FILTER_STATUS(0xB0)
+#define TUH_MIDI_FILTER_PROGRAM_CHANGE    TUH_MIDI_FILTER_STATUS(0xC0)
+#define TUH_MIDI_FILTER_CHANNEL_PRESSURE  TUH_MIDI_FILTER_STATUS(0xD0)
+#define TUH_MIDI_FILTER_PITCH_BEND        TUH_MIDI_FILTER_STATUS(0xE0)
+#define TUH_MIDI_FILTER_SYSEX             TUH_MIDI_FILTER_STATUS(0xF0)
+#define TUH_MIDI_FILTER_CLOCK             TUH_MIDI_FILTER_STATUS(0xF8)
+#define TUH_MIDI_FILTER_ACTIVE_SENSING    TUH_MIDI_FILTER_STATUS(0xFE)
+#define TUH_MIDI_FILTER_REALTIME          0xFF000000ul
+#define TUH_MIDI_FILTER_ALL               0xFFFFFFFFul
+// cable_num value that sets the filter of every cable
+#define TUH_MIDI_ALL_CABLES 0xFF
+
+// Drop received messages on cable_num (or TUH_MIDI_ALL_CABLES) whose
+// type bit is set in drop_types or, for channel messages, whose channel
+// (0-15) bit is set in drop_channels. Filtered messages never reach the
+// RX FIFO, tuh_midi_rt_cb(), tuh_midi_sysex_cb() or tuh_midi_rx_cb(), so a
+// device that floods clock or active sensing does not wake the application.
+// Pass TUH_MIDI_FILTER_ALL to drop everything on a cable and 0, 0 to
+// remove a filter. The filters are cleared when the device is mounted.
+// With CFG_MIDI_HOST_STATS, tuh_midi_get_stats() counts the dropped packets.
+// Returns false if the device is not mounted or cable_num is not valid.
+bool tuh_midi_set_rx_filter(uint8_t dev_addr, uint8_t cable_num, uint32_t drop_types, uint16_t drop_channels);
+#endif
+
+#if CFG_MIDI_HOST_STATS
+// Counters since the device was mounted or tuh_midi_reset_stats() was called
+typedef struct
+{
+  uint32_t rx_xfers;           // IN transfers completed
+  uint32_t rx_bytes;           // bytes in those transfers
+  uint32_t rx_packets;         // non-zero packets received
+  uint32_t rx_zero_packets;    // all zero filler packets discarded
+  uint32_t rx_dropped_packets; // received packets not queued because the RX FIFO was full
+  uint32_t rx_discarded_packets; // packets TUH_MIDI_RX_DROP_OLDEST discarded to make room
+  uint32_t rx_dropped_sysex;   // SysEx messages TUH_MIDI_RX_DROP_SYSEX cut short or dropped
+  uint32_t rx_ff_high_water;   // most bytes ever queued in an RX FIFO
+  uint32_t rx_flow_pauses;     // times RX flow control stopped IN polling
+  uint32_t rx_sysex_truncated; // SysEx messages tuh_midi_sysex_cb() got incomplete
+  uint32_t rx_filtered_channel; // channel message packets tuh_midi_set_rx_filter() filters dropped
+  uint32_t rx_filtered_sysex;  // SysEx packets the filters dropped
+  uint32_t rx_filtered_common; // system common message packets the filters dropped
+  uint32_t rx_filtered_realtime; // system real-time message packets the filters dropped
+  uint32_t tx_xfers;           // OUT transfers completed, including ZLPs
+  uint32_t tx_bytes;           // bytes in those transfers
+  uint32_t tx_zlps;            // zero length packets sent
+  uint32_t tx_refused_bytes;   // bytes tuh_midi_stream_write() could not queue
+  uint32_t tx_refused_packets; // packets the packet write functions could not queue
+  uint32_t tx_ff_high_water;   // most bytes ever queued in the TX FIFO
+  uint32_t xfer_failures;      // transfers that completed with XFER_RESULT_FAILED
+  uint32_t xfer_stalls;        // transfers that completed with XFER_RESULT_STALLED
+} tuh_midi_stats_t;
+
+// Copy the device's counters to *p_stats. Returns false if dev_addr is invalid.
+bool tuh_midi_get_stats(uint8_t dev_addr, tuh_midi_stats_t* p_stats);
+
+// Zero the device's counters. Returns false if dev_addr is invalid.
+bool tuh_midi_reset_stats(uint8_t dev_addr);
+#endif
+
+#if CFG_MIDI_HOST_TRACE
+#include "usb_midi_host_trace.h"
+
+// Copy up to max_records of the oldest trace records to p_records and
+// remove them from the trace ring, which holds the last
+// CFG_TUH_MIDI_TRACE_DEPTH records (default 256). If records were
+// overwritten since the last read, the first record copied is a
+// TUH_MIDI_TRACE_LOST record whose arg is how many. Send the records
+// over any transport as is and turn them into a timeline with the
+// midih_trace_decode tool in the bench directory. Returns the number of
+// records copied.
+uint32_t tuh_midi_trace_read(tuh_midi_trace_record_t* p_records, uint32_t max_records);
+
+// Discard all trace records
+void tuh_midi_trace_clear(void);
+#endif
+
+#if CFG_MIDI_HOST_TX_SCHEDULE
+// Queue a packet to be sent at time due_us on the tuh_midi_time_us() clock.
+// Packets wait in a per-device schedule of CFG_TUH_MIDI_TX_SCHED_DEPTH
+// packets (default 32) and move to the normal queue when they are due;
+// packets due at the same time go out in the order they were queued. Due
+// times must be less than about 35 minutes away. Due packets are sent,
+// together with anything else queued, from tuh_midi_task(), from
+// tuh_midi_stream_flush() and when a transfer completes. A device that is
+// not sending or receiving completes no transfers, so the application
+// must call tuh_midi_task() from its main loop for the packets to go out
+// on time. Returns false if the schedule is full.
+bool tuh_midi_packet_write_at(uint8_t dev_addr, uint8_t const packet[4], uint32_t due_us);
+
+// Return the number of packets tuh_midi_packet_write_at() can still queue
+uint32_t tuh_midi_packet_write_at_available(uint8_t dev_addr);
+#endif
+
 // Get the MIDI stream from the device. Set the value pointed
 // to by p_cable_num to the MIDI cable number intended to receive it.
 // The MIDI stream will be stored in the buffer pointed to by p_buffer.
 // Return the number of bytes added to the buffer.
+// This function never writes more than bufsize bytes and never splits
+// a MIDI message across calls; messages that do not fit stay queued for
+// the next call. bufsize must be at least 3 bytes, the length of the
+// longest non-SysEx message; with less, this returns 0 and reads nothing.
 // Note that this function ignores the CIN field of the MIDI packet
 // because a number of commercial devices out there do not encode
 // it properly.
 uint32_t tuh_midi_stream_read (uint8_t dev_addr, uint8_t *p_cable_num, uint8_t *p_buffer, uint16_t bufsize);
 
+// One received MIDI message, decoded from its USB MIDI packet
+typedef struct
+{
+  uint8_t cable_num;
+  uint8_t type;     // 0x80-0xE0 for channel messages (the status byte without
+                    // the channel) or the status byte 0xF1-0xFF of a system message
+  uint8_t channel;  // 0-15 for channel messages, otherwise 0
+  uint8_t data1;    // the first data byte, e.g. note or controller number
+  uint8_t data2;    // the second data byte, e.g. velocity or controller value
+  uint16_t value;   // data1 | data2 << 7, the 14-bit value of Pitch Bend
+                    // and Song Position Pointer messages
+} tuh_midi_event_t;
+
+// Read up to max_events received MIDI messages as decoded events, without
+// turning the packets into a byte stream. A Note On with velocity 0 is
+// reported as it was received. Packets that hold SysEx data are read and
+// skipped; to get SysEx messages as well, use tuh_midi_sysex_cb() (see
+// CFG_MIDI_HOST_SYSEX_RX). This and tuh_midi_stream_read() share the SysEx
+// state of each cable, so the two can be called in turn on the same device.
+// Return the number of events read.
+uint32_t tuh_midi_event_read(uint8_t dev_addr, tuh_midi_event_t* events, uint32_t max_events);
+
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+// Same as tuh_midi_stream_read() except it only returns bytes from
+// packets that arrived in the same USB transfer and stores the time
+// that transfer completed in *p_timestamp. The time is in microseconds
+// from CFG_TUH_MIDI_TIME_US() and wraps.
+uint32_t tuh_midi_stream_read_ts (uint8_t dev_addr, uint8_t *p_cable_num, uint8_t *p_buffer, uint16_t bufsize, uint32_t *p_timestamp);
+#endif
+
+#if CFG_MIDI_HOST_RX_CABLE_QUEUES
+// Same as tuh_midi_stream_read() but only read the MIDI stream from
+// virtual cable cable_num.
+uint32_t tuh_midi_stream_read_cable (uint8_t dev_addr, uint8_t cable_num, uint8_t *p_buffer, uint16_t bufsize);
+#endif
+
 // Read a raw MIDI packet from the connected device
 // This function does not parse the packet format
 // Return true if a packet was returned
 bool tuh_midi_packet_read (uint8_t dev_addr, uint8_t packet[4]);
 
+#if CFG_MIDI_HOST_RX_TIMESTAMPS
+// Same as tuh_midi_packet_read() but also store the time the packet
+// arrived in *p_timestamp; see tuh_midi_stream_read_ts()
+bool tuh_midi_packet_read_ts (uint8_t dev_addr, uint8_t packet[4], uint32_t *p_timestamp);
+#endif
+
+// Read up to max_packets raw 4-byte MIDI packets from the connected device
+// into the buffer pointed to by packets, which must hold at least
+// 4*max_packets bytes. This function does not parse the packet format.
+// Return the number of packets read.
+uint32_t tuh_midi_packet_read_n (uint8_t dev_addr, uint8_t* packets, uint32_t max_packets);
+
+// Borrow raw 4-byte MIDI packets in place in the receive FIFO without
+// copying them. Set *p_packets to point to the first packet and return
+// the number of packets stored contiguously from there. Return 0 if there
+// are no packets to read. When the FIFO contents wrap around the end of
+// the FIFO storage, only the first part is returned; call
+// tuh_midi_packet_consume() and then this function again to get the rest.
+// The packets stay valid until tuh_midi_packet_consume() is called.
+uint32_t tuh_midi_packet_peek (uint8_t dev_addr, uint8_t const** p_packets);
+
+// Release num_packets packets borrowed with tuh_midi_packet_peek()
+// back to the receive FIFO.
+void tuh_midi_packet_consume (uint8_t dev_addr, uint32_t num_packets);
+
 uint8_t tuh_midi_get_num_rx_cables(uint8_t dev_addr);
 uint8_t tuh_midi_get_num_tx_cables(uint8_t dev_addr);
 #if CFG_MIDI_HOST_DEVSTRINGS
@@ -165,6 +573,27 @@ TU_ATTR_WEAK void tuh_midi_umount_cb(uint8_t dev_addr, uint8_t instance);
 
 TU_ATTR_WEAK void tuh_midi_rx_cb(uint8_t dev_addr, uint32_t num_packets);
 TU_ATTR_WEAK void tuh_midi_tx_cb(uint8_t dev_addr);
+
+// Invoked from the USB transfer complete callback for every received
+// real-time message (status 0xF8-0xFF, e.g. Timing Clock, Start, Stop)
+// before the message is queued and before tuh_midi_rx_cb() is called.
+// Keep it short; it runs in the same context as tuh_midi_rx_cb().
+TU_ATTR_WEAK void tuh_midi_rt_cb(uint8_t dev_addr, uint8_t cable_num, uint8_t status);
+
+#if CFG_MIDI_HOST_SYSEX_RX
+// If the application defines this callback, received SysEx messages do not
+// go in the RX FIFO. The driver collects each one, 0xF0 through 0xF7, in
+// one of CFG_TUH_MIDI_SYSEX_BUFFERS buffers of CFG_TUH_MIDI_SYSEX_BUFSIZE
+// bytes shared by all devices and cables, then calls this once the message
+// ends. Like tuh_midi_stream_read(), the driver goes by the status bytes,
+// not the packets' CIN: data bytes and 0xF7 continue a message, real-time
+// messages pass through, and any other status ends it without 0xF7.
+// truncated is true if the message did not fit in a buffer, if no buffer
+// was free when it started (then len is 0), or if it ended without 0xF7.
+// data is only valid until the callback returns. It runs in the same
+// context as tuh_midi_rx_cb().
+TU_ATTR_WEAK void tuh_midi_sysex_cb(uint8_t dev_addr, uint8_t cable_num, uint8_t const* data, uint32_t len, bool truncated);
+#endif
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,80 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * The binary format of the USB MIDI Host driver's event trace. This file
+ * only depends on <stdint.h> so host-side tools such as
+ * bench/trace_decode.c can share it with the driver.
+ */
+#ifndef _USB_MIDI_HOST_TRACE_H_
+#define _USB_MIDI_HOST_TRACE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// What each trace record's arg field holds is in the comment
+typedef enum
+{
+  TUH_MIDI_TRACE_LOST = 0,      // records overwritten before they were read
+  TUH_MIDI_TRACE_MOUNT,         // number of TX cables << 8 | RX cables
+  TUH_MIDI_TRACE_UMOUNT,        // 0
+  TUH_MIDI_TRACE_IN_SUBMIT,     // bytes requested
+  TUH_MIDI_TRACE_IN_DONE,       // bytes received
+  TUH_MIDI_TRACE_OUT_SUBMIT,    // bytes sent; 0 for a ZLP
+  TUH_MIDI_TRACE_OUT_DONE,      // bytes sent
+  TUH_MIDI_TRACE_XFER_FAILED,   // endpoint address << 8 | xfer_result_t
+  TUH_MIDI_TRACE_RX_QUEUED,     // packets put in the RX FIFO(s)
+  TUH_MIDI_TRACE_RX_LEVEL,      // bytes in the RX FIFO written last
+  TUH_MIDI_TRACE_RX_CB_ENTER,   // packets passed to tuh_midi_rx_cb()
+  TUH_MIDI_TRACE_RX_CB_EXIT,    // 0
+  TUH_MIDI_TRACE_RT_CB_ENTER,   // status byte passed to tuh_midi_rt_cb()
+  TUH_MIDI_TRACE_RT_CB_EXIT,    // 0
+  TUH_MIDI_TRACE_TX_CB_ENTER,   // 0
+  TUH_MIDI_TRACE_TX_CB_EXIT,    // 0
+  TUH_MIDI_TRACE_FLUSH,         // bytes waiting to be sent
+  TUH_MIDI_TRACE_TX_HELD,       // bytes held back by TX coalescing
+  TUH_MIDI_TRACE_RX_PAUSE,      // 0
+  TUH_MIDI_TRACE_RX_RESUME,     // bytes in the fullest RX FIFO
+  TUH_MIDI_TRACE_NUM_EVENTS
+} tuh_midi_trace_event_t;
+
+// One 8-byte trace record. The driver stores records in the target's byte
+// order, which is little endian on the RP2040.
+typedef struct
+{
+  uint32_t time_us;  // tuh_midi_time_us() when the event happened
+  uint8_t event;     // a tuh_midi_trace_event_t
+  uint8_t dev_addr;  // 0 if the event is not for a device
+  uint16_t arg;      // depends on the event
+} tuh_midi_trace_record_t;
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _USB_MIDI_HOST_TRACE_H_ */